@@ -0,0 +1,129 @@
+#include "appsrc_pool.h"
+
+#include <cstdio>
+
+#define APPSRC_POOL_KEY     "appsrc-pool"
+#define APPSRC_POOL_ALIGN   4096
+
+static void appsrc_pool_free(gpointer _udata)
+{
+    AppsrcPool* pool = (AppsrcPool*)_udata;
+
+    if (pool->pool)
+    {
+        gst_buffer_pool_set_active(pool->pool, FALSE);
+        gst_object_unref(pool->pool);
+    }
+    delete pool;
+}
+
+static GstBufferPool* appsrc_pool_create(guint buffer_size, guint min_buffers, guint max_buffers)
+{
+    GstBufferPool* pool   = gst_buffer_pool_new();
+    GstStructure*  config = gst_buffer_pool_get_config(pool);
+
+    gst_buffer_pool_config_set_params(config, NULL, buffer_size, min_buffers, max_buffers);
+
+    if (!gst_buffer_pool_set_config(pool, config) ||
+        !gst_buffer_pool_set_active(pool, TRUE))
+    {
+        printf("[appsrc_pool][configure pool failed, size:%u]\n", buffer_size);
+        gst_object_unref(pool);
+        return nullptr;
+    }
+    return pool;
+}
+
+/* lock held. buffers still in flight keep the old pool alive, it frees them
+ * as they come back since it is no longer active */
+static void appsrc_pool_grow(AppsrcPool* pool, gsize size)
+{
+    gsize          wanted = size + size / 4;
+    guint          buffer_size = (guint)((wanted + APPSRC_POOL_ALIGN - 1) & ~(gsize)(APPSRC_POOL_ALIGN - 1));
+    GstBufferPool* next   = appsrc_pool_create(buffer_size, pool->min_buffers, pool->max_buffers);
+
+    if (!next)
+    {
+        return;
+    }
+    if (pool->pool)
+    {
+        gst_buffer_pool_set_active(pool->pool, FALSE);
+        gst_object_unref(pool->pool);
+    }
+    printf("[appsrc_pool][grow %u => %u]\n", pool->buffer_size, buffer_size);
+    pool->pool        = next;
+    pool->buffer_size = buffer_size;
+    pool->grows++;
+}
+
+AppsrcPool* appsrc_pool_attach(GstElement* appsrc, guint buffer_size,
+                               guint min_buffers, guint max_buffers)
+{
+    AppsrcPool* pool = new AppsrcPool();
+
+    pool->pool        = appsrc_pool_create(buffer_size, min_buffers, max_buffers);
+    pool->buffer_size = buffer_size;
+    pool->min_buffers = min_buffers;
+    pool->max_buffers = max_buffers;
+
+    g_object_set_data_full(G_OBJECT(appsrc), APPSRC_POOL_KEY, pool, appsrc_pool_free);
+    return pool;
+}
+
+AppsrcPool* appsrc_pool_get(GstElement* appsrc)
+{
+    return (AppsrcPool*)g_object_get_data(G_OBJECT(appsrc), APPSRC_POOL_KEY);
+}
+
+GstBuffer* appsrc_pool_acquire(AppsrcPool* pool, gsize size)
+{
+    GstBuffer* buffer = nullptr;
+
+    if (!pool)
+    {
+        return gst_buffer_new_allocate(NULL, size, NULL);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+
+        if (size > pool->buffer_size)
+        {
+            appsrc_pool_grow(pool, size);
+        }
+        if (pool->pool && size <= pool->buffer_size)
+        {
+            GstBufferPoolAcquireParams params = {};
+            params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+
+            if (gst_buffer_pool_acquire_buffer(pool->pool, &buffer, &params) != GST_FLOW_OK)
+            {
+                buffer = nullptr;
+            }
+        }
+    }
+
+    if (buffer)
+    {
+        /* the pool restores the full size when the buffer comes back */
+        gst_buffer_set_size(buffer, size);
+        pool->hits++;
+        return buffer;
+    }
+
+    pool->misses++;
+    return gst_buffer_new_allocate(NULL, size, NULL);
+}
+
+void appsrc_pool_print_stats(const char* name, AppsrcPool* pool)
+{
+    if (!pool)
+    {
+        return;
+    }
+
+    printf("[appsrc_pool][%s size:%u hits:%llu misses:%llu grows:%llu]\n", name, pool->buffer_size,
+        (unsigned long long)pool->hits, (unsigned long long)pool->misses,
+        (unsigned long long)pool->grows);
+}
@@ -0,0 +1,48 @@
+#ifndef APPSRC_POOL_H
+#define APPSRC_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <gst/gst.h>
+
+/**
+ * GstBufferPool in front of an appsrc, for feeders that have to copy their
+ * data into a GstBuffer anyway.
+ *
+ * buffers start at an estimate of the stream's peak frame size and are
+ * recycled once the pipeline releases them. a frame larger than the pool
+ * buffers replaces the pool with one sized a quarter above that frame, the
+ * old buffers are freed as they come back, so the pool follows the observed
+ * peak. a request made while every pool buffer is in flight falls back to
+ * gst_buffer_new_allocate and counts as a miss.
+ * */
+struct AppsrcPool
+{
+    std::mutex            lock;                 // pool / buffer_size, for a grow
+    GstBufferPool*        pool        = nullptr;
+    guint                 buffer_size = 0;
+    guint                 min_buffers = 0;
+    guint                 max_buffers = 0;
+    std::atomic<guint64>  hits        {0};
+    std::atomic<guint64>  misses      {0};
+    std::atomic<guint64>  grows       {0};
+};
+
+/**
+ * @brief create a pool and attach it to the appsrc, it is freed with the appsrc
+ * @param buffer_size expected peak frame size of the stream, grown when exceeded
+ * @param min_buffers buffers allocated up front
+ * @param max_buffers upper bound of buffers in flight, 0 for unlimited
+ * */
+AppsrcPool* appsrc_pool_attach(GstElement* appsrc, guint buffer_size,
+                               guint min_buffers, guint max_buffers);
+
+/* pool attached to the appsrc, nullptr if there is none */
+AppsrcPool* appsrc_pool_get(GstElement* appsrc);
+
+/* buffer of exactly size bytes, from the pool when possible */
+GstBuffer* appsrc_pool_acquire(AppsrcPool* pool, gsize size);
+
+void appsrc_pool_print_stats(const char* name, AppsrcPool* pool);
+
+#endif // APPSRC_POOL_H
@@ -1,4 +1,14 @@
 #include <gst/gst.h>
+#include <glib/gstdio.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "h264_nal.h"
+
 // video/x-h264:
 //   stream-format: { (string)avc, (string)avc3 }
 //       alignment: au
@@ -12,15 +22,293 @@
  * gst-launch-1.0 filesrc location=../media/video.raw ! rawvideoparse width=320 height=240 framerate=30/1 ! x264enc ! h264parse ! qtmux ! filesink location=xxx.mov
  * */
 
+/**
+ * batch remux of raw H.264 into MOV/MP4, no re-encoding :
+ *   filesrc ! video/x-h264,framerate=N/D ! h264parse ! qtmux|mp4mux ! filesink
+ *
+ * every input gets its own pipeline, a pool of workers (one per core by
+ * default) runs that many pipelines at once. raw streams have no timestamps,
+ * h264parse derives them from the frame rate of the leading SPS, or --fps.
+ * nothing syncs to the clock, so a file is remuxed as fast as it is read.
+ * */
+
+#define DEFAULT_FPS         25
+#define REMUX_BLOCK_SIZE    (1024*1024)     // filesrc read size
+#define SPS_PROBE_SIZE      (1024*1024)
+
+static gint    jobs     = 0;
+static gchar*  format   = (gchar*)"mov";
+static gchar*  out_dir  = NULL;
+static gint    fps      = DEFAULT_FPS;
+static gchar** inputs   = NULL;
+
+static GOptionEntry entries[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Files remuxed at the same time, 0 = one per core", "N"},
+  {"format", 'f', 0, G_OPTION_ARG_STRING, &format,
+      "Container, mov or mp4 (default: mov)", "FORMAT"},
+  {"output", 'o', 0, G_OPTION_ARG_STRING, &out_dir,
+      "Directory for the remuxed files (default: next to each input)", "DIR"},
+  {"fps", 'r', 0, G_OPTION_ARG_INT, &fps,
+      "Frame rate of inputs whose SPS has no timing info (default: 25)", "FPS"},
+  {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs,
+      NULL, "INPUT..."},
+  {NULL}
+};
+
+struct RemuxJob
+{
+    std::string input;
+    std::string output;
+    guint64     bytes    = 0;
+    gint64      elapsed  = 0;       // us
+    gint64      media    = 0;       // ns of video written
+    bool        ok       = false;
+};
+
+/* frame rate from the VUI of the leading SPS, --fps otherwise */
+static void probe_framerate(const char* _path, int* _num, int* _den)
+{
+    std::vector<uint8_t> head(SPS_PROBE_SIZE);
+    FILE*      file = fopen(_path, "rb");
+    size_t     size = 0;
+    H264AuInfo info;
+    H264Sps    sps;
+    uint32_t   num, den;
+
+    if (file)
+    {
+        size = fread(head.data(), 1, head.size(), file);
+        fclose(file);
+    }
+
+    h264_au_parse(head.data(), size, &info);
+    if (info.sps.data && h264_sps_parse(info.sps.data, info.sps.size, &sps) && sps.framerate(&num, &den))
+    {
+        *_num = (int)num;
+        *_den = (int)den;
+        return;
+    }
+
+    *_num = fps;
+    *_den = 1;
+}
+
+/* GThreadPool worker, runs one pipeline to the end */
+static void remux_file(gpointer _data, gpointer _udata)
+{
+    RemuxJob*   job      = (RemuxJob*)_data;
+    GError*     error    = NULL;
+    GstElement* pipeline = NULL;
+    GstBus*     bus      = NULL;
+    GstMessage* msg      = NULL;
+    GStatBuf    st;
+    int         num, den;
+
+    probe_framerate(job->input.c_str(), &num, &den);
+
+    gchar* desc = g_strdup_printf(
+        "filesrc name=src blocksize=%d ! video/x-h264,stream-format=byte-stream,framerate=%d/%d ! "
+        "h264parse ! video/x-h264,stream-format=avc,alignment=au ! %s ! filesink name=sink",
+        REMUX_BLOCK_SIZE, num, den, g_strcmp0(format, "mp4") == 0 ? "mp4mux" : "qtmux");
+    pipeline = gst_parse_launch(desc, &error);
+    g_free(desc);
+    if (!pipeline)
+    {
+        g_printerr("%s: create pipeline failed: %s\n", job->input.c_str(), error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    /* locations are set here, file names may contain anything */
+    GstElement* src  = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_object_set(src, "location", job->input.c_str(), NULL);
+    g_object_set(sink, "location", job->output.c_str(), NULL);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+
+    gint64 start = g_get_monotonic_time();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    bus = gst_element_get_bus(pipeline);
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+        gchar* debug = NULL;
+        gst_message_parse_error(msg, &error, &debug);
+        g_printerr("%s: %s (%s)\n", job->input.c_str(), error->message, debug ? debug : "");
+        g_clear_error(&error);
+        g_free(debug);
+    }
+    else
+    {
+        gst_element_query_position(pipeline, GST_FORMAT_TIME, &job->media);
+        job->ok = true;
+    }
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    /* the muxer wrote the moov on EOS, NULL only closes the file */
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    job->elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+    if (g_stat(job->input.c_str(), &st) == 0)
+    {
+        job->bytes = (guint64)st.st_size;
+    }
+
+    if (job->ok)
+    {
+        g_print("%s -> %s: %.1f MB in %.2fs, %.1f MB/s, %.1fx real time\n",
+            job->input.c_str(), job->output.c_str(), job->bytes / 1e6, job->elapsed / 1e6,
+            job->bytes / (double)job->elapsed, (job->media / 1e3) / job->elapsed);
+    }
+}
+
+static bool is_h264_file(const gchar* _name)
+{
+    return g_str_has_suffix(_name, ".264") || g_str_has_suffix(_name, ".h264");
+}
+
+static bool output_taken(const std::vector<RemuxJob*>& _jobs, const std::string& _output)
+{
+    for (const RemuxJob* job : _jobs)
+    {
+        if (job->output == _output)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* a.264 -> a.mov, unless another input already maps there : a.h264 next to
+ * it keeps its whole name, a.h264.mov, and a number is added past that */
+static void add_job(std::vector<RemuxJob*>& _jobs, const gchar* _input)
+{
+    RemuxJob*   job  = new RemuxJob();
+    const char* ext  = g_strcmp0(format, "mp4") == 0 ? "mp4" : "mov";
+    gchar*      base = g_path_get_basename(_input);
+    gchar*      dir  = out_dir ? g_strdup(out_dir) : g_path_get_dirname(_input);
+    gchar*      dot  = strrchr(base, '.');
+    std::string stem = dot && dot != base ? std::string(base, dot - base) : std::string(base);
+
+    gchar* name   = g_strdup_printf("%s.%s", stem.c_str(), ext);
+    gchar* output = g_build_filename(dir, name, NULL);
+
+    for (int n = 1; output_taken(_jobs, output); n++)
+    {
+        g_free(name);
+        g_free(output);
+        name   = n == 1 ? g_strdup_printf("%s.%s", base, ext) : g_strdup_printf("%s_%d.%s", base, n, ext);
+        output = g_build_filename(dir, name, NULL);
+    }
+
+    job->input  = _input;
+    job->output = output;
+    _jobs.push_back(job);
+
+    g_free(output);
+    g_free(name);
+    g_free(dir);
+    g_free(base);
+}
+
+/* inputs are files, or directories whose .264/.h264 files are all taken */
+static void collect_jobs(std::vector<RemuxJob*>& _jobs)
+{
+    for (gchar** input = inputs; input && *input; input++)
+    {
+        if (!g_file_test(*input, G_FILE_TEST_IS_DIR))
+        {
+            add_job(_jobs, *input);
+            continue;
+        }
+
+        GDir* dir = g_dir_open(*input, 0, NULL);
+        const gchar* name;
+        while (dir && (name = g_dir_read_name(dir)))
+        {
+            if (is_h264_file(name))
+            {
+                gchar* path = g_build_filename(*input, name, NULL);
+                add_job(_jobs, path);
+                g_free(path);
+            }
+        }
+        if (dir)
+        {
+            g_dir_close(dir);
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s  h264raw(320*240 30) record_file\n"
-            "API example program to show how to read frames from an input file.\n"
-            "This program reads frames from a rawvideo_file, encode them, and writes to h264_file\n",
-            argv[0]);
+    GOptionContext* optctx;
+    GError*         error = NULL;
+    std::vector<RemuxJob*> all_jobs;
+
+    optctx = g_option_context_new("- remux raw H.264 files or directories into MOV/MP4");
+    g_option_context_add_main_entries(optctx, entries, NULL);
+    g_option_context_add_group(optctx, gst_init_get_option_group());
+    if (!g_option_context_parse(optctx, &argc, &argv, &error)) {
+        g_printerr("Error parsing options: %s\n", error->message);
+        g_option_context_free(optctx);
+        g_clear_error(&error);
+        return -1;
+    }
+    g_option_context_free(optctx);
+
+    if (fps <= 0)
+    {
+        g_printerr("--fps must be > 0\n");
+        return -1;
+    }
+
+    collect_jobs(all_jobs);
+    if (all_jobs.empty())
+    {
+        fprintf(stderr, "usage: %s [-j jobs] [-f mov|mp4] [-o dir] [-r fps] input.h264|dir ...\n", argv[0]);
         exit(1);
     }
+    if (out_dir)
+    {
+        g_mkdir_with_parents(out_dir, 0755);
+    }
+    if (jobs <= 0)
+    {
+        jobs = (gint)g_get_num_processors();
+    }
+
+    /* every worker drives one pipeline at a time */
+    gint64 start = g_get_monotonic_time();
+    GThreadPool* pool = g_thread_pool_new(remux_file, NULL, jobs, TRUE, NULL);
+    for (RemuxJob* job : all_jobs)
+    {
+        g_thread_pool_push(pool, job, NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+    gint64 elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+    guint64 bytes = 0;
+    gint64  media = 0;
+    int     failed = 0;
+    for (RemuxJob* job : all_jobs)
+    {
+        bytes  += job->bytes;
+        media  += job->media;
+        failed += job->ok ? 0 : 1;
+        delete job;
+    }
 
+    g_print("%u files (%d failed) with %d jobs: %.1f MB in %.2fs, %.1f MB/s, %.1fx real time\n",
+        (unsigned)all_jobs.size(), failed, jobs, bytes / 1e6, elapsed / 1e6,
+        bytes / (double)elapsed, (media / 1e3) / elapsed);
 
-}
\ No newline at end of file
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+#include "channel_manager.h"
+
+#include <cstdio>
+#include <vector>
+
+/* ends the shutdown once nothing is recording or closing. lock held */
+static bool channel_manager_drained(ChannelManager* manager)
+{
+    return manager->shutting_down && manager->channels.empty() && manager->closing.empty();
+}
+
+static void channel_manager_notify_done(ChannelManager* manager)
+{
+    ChannelManagerDoneFunc done = manager->done;
+
+    manager->done = nullptr;
+    if (done)
+    {
+        done(manager->done_udata);
+    }
+}
+
+static void channel_finalized_callback(Recorder* recorder, gpointer udata)
+{
+    ChannelManager* manager = (ChannelManager*)udata;
+    RecorderPtr     closed;
+    bool            drained;
+
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        auto it = manager->closing.find(recorder);
+        if (it == manager->closing.end())
+        {
+            return;
+        }
+        closed = it->second;
+        manager->closing.erase(it);
+        drained = channel_manager_drained(manager);
+    }
+
+    printf("[channel_manager][%s finalized]\n", recorder->config.name.c_str());
+    if (drained)
+    {
+        channel_manager_notify_done(manager);
+    }
+    /* closed goes out of scope last, the recorder is freed after its callback */
+}
+
+bool channel_manager_add(ChannelManager* manager, const RecorderConfig& config)
+{
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        if (manager->shutting_down)
+        {
+            return false;
+        }
+        if (manager->channels.count(config.name))
+        {
+            printf("[channel_manager][%s already recording]\n", config.name.c_str());
+            return false;
+        }
+    }
+
+    /* built outside the lock, a slow pipeline does not hold up the others */
+    RecorderPtr recorder = recorder_create(config);
+    if (!recorder)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(manager->lock);
+    if (!manager->channels.emplace(config.name, recorder).second)
+    {
+        return false;
+    }
+    printf("[channel_manager][%s added, %u channels]\n",
+        config.name.c_str(), (unsigned)manager->channels.size());
+    return true;
+}
+
+struct ChannelFinalize
+{
+    ChannelManager* manager;
+    RecorderPtr     recorder;
+};
+
+static gboolean channel_finalize_callback(gpointer udata)
+{
+    ChannelFinalize* finalize = (ChannelFinalize*)udata;
+
+    recorder_finalize(finalize->recorder.get(), channel_finalized_callback, finalize->manager);
+    return G_SOURCE_REMOVE;
+}
+
+static void channel_finalize_free(gpointer udata)
+{
+    delete (ChannelFinalize*)udata;
+}
+
+bool channel_manager_remove(ChannelManager* manager, const std::string& name)
+{
+    RecorderPtr recorder;
+
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        auto it = manager->channels.find(name);
+        if (it == manager->channels.end())
+        {
+            return false;
+        }
+        recorder = it->second;
+        manager->channels.erase(it);
+        manager->closing[recorder.get()] = recorder;
+        printf("[channel_manager][%s removed, %u channels]\n",
+            name.c_str(), (unsigned)manager->channels.size());
+    }
+
+    /* right here on the main loop, queued to it from any other thread */
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, channel_finalize_callback,
+        new ChannelFinalize{manager, recorder}, channel_finalize_free);
+    return true;
+}
+
+RecorderPtr channel_manager_find(ChannelManager* manager, const std::string& name)
+{
+    std::lock_guard<std::mutex> guard(manager->lock);
+    auto it = manager->channels.find(name);
+    return it != manager->channels.end() ? it->second : nullptr;
+}
+
+void channel_manager_sync(ChannelManager* manager, const std::map<std::string, RecorderConfig>& configs)
+{
+    std::vector<std::string> gone;
+
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        for (auto& channel : manager->channels)
+        {
+            auto it = configs.find(channel.first);
+            if (it == configs.end())
+            {
+                gone.push_back(channel.first);
+            }
+            else if (!recorder_config_equal(channel.second->config, it->second))
+            {
+                printf("[channel_manager][%s config changed]\n", channel.first.c_str());
+                gone.push_back(channel.first);
+            }
+        }
+    }
+
+    /* a changed channel closes its file in the background, the new pipeline
+     * starts right away */
+    for (const std::string& name : gone)
+    {
+        channel_manager_remove(manager, name);
+    }
+    for (auto& config : configs)
+    {
+        if (!channel_manager_find(manager, config.first))
+        {
+            channel_manager_add(manager, config.second);
+        }
+    }
+}
+
+void channel_manager_shutdown(ChannelManager* manager, ChannelManagerDoneFunc done, gpointer udata)
+{
+    std::vector<std::string> names;
+    bool                     drained;
+
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        manager->shutting_down = true;
+        manager->done          = done;
+        manager->done_udata    = udata;
+        for (auto& channel : manager->channels)
+        {
+            names.push_back(channel.first);
+        }
+        drained = channel_manager_drained(manager);
+    }
+
+    for (const std::string& name : names)
+    {
+        channel_manager_remove(manager, name);
+    }
+    if (drained)
+    {
+        channel_manager_notify_done(manager);
+    }
+}
+
+void channel_manager_foreach(ChannelManager* manager, void (*fn)(Recorder*, gpointer), gpointer udata)
+{
+    std::vector<RecorderPtr> recorders;
+
+    {
+        std::lock_guard<std::mutex> guard(manager->lock);
+        for (auto& channel : manager->channels)
+        {
+            recorders.push_back(channel.second);
+        }
+    }
+
+    for (RecorderPtr& recorder : recorders)
+    {
+        fn(recorder.get(), udata);
+    }
+}
+
+static void print_stats_fn(Recorder* recorder, gpointer udata)
+{
+    recorder_print_stats(recorder);
+}
+
+void channel_manager_print_stats(ChannelManager* manager)
+{
+    channel_manager_foreach(manager, print_stats_fn, NULL);
+}
@@ -0,0 +1,56 @@
+#ifndef CHANNEL_MANAGER_H
+#define CHANNEL_MANAGER_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "recorder.h"
+
+/* called on the main loop once shutdown closed the last file */
+typedef void (*ChannelManagerDoneFunc)(gpointer udata);
+
+/**
+ * the recording channels of the process by name. channels are added and
+ * removed at runtime from any thread. a removed channel finalizes its last
+ * split file first, it stays in closing until its EOS came through. the
+ * finalize itself is handed to the default main context, where the bus
+ * watches and restart timers of the recorders run. a capture thread holds
+ * the recorder it found, the recorder is freed once the last holder lets go
+ * of it.
+ * */
+struct ChannelManager
+{
+    std::mutex                         lock;
+    std::map<std::string, RecorderPtr> channels;
+    std::map<Recorder*, RecorderPtr>   closing;
+
+    bool                               shutting_down = false;
+    ChannelManagerDoneFunc             done          = nullptr;
+    gpointer                           done_udata    = nullptr;
+};
+
+/* false if the name is taken or the pipeline could not be built */
+bool channel_manager_add(ChannelManager* manager, const RecorderConfig& config);
+
+/* false if there is no such channel, the channel finalizes in the background */
+bool channel_manager_remove(ChannelManager* manager, const std::string& name);
+
+RecorderPtr channel_manager_find(ChannelManager* manager, const std::string& name);
+
+/* remove the channels missing from configs, add the configs that are new,
+ * a channel whose config changed is removed and added again */
+void channel_manager_sync(ChannelManager* manager, const std::map<std::string, RecorderConfig>& configs);
+
+/**
+ * @brief finalize every channel and refuse new ones, done runs once the last
+ *        file is closed, right away if there is no channel
+ * */
+void channel_manager_shutdown(ChannelManager* manager, ChannelManagerDoneFunc done, gpointer udata);
+
+/* fn on every channel, outside the lock */
+void channel_manager_foreach(ChannelManager* manager, void (*fn)(Recorder*, gpointer), gpointer udata);
+
+void channel_manager_print_stats(ChannelManager* manager);
+
+#endif // CHANNEL_MANAGER_H
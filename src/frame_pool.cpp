@@ -0,0 +1,188 @@
+#include "frame_pool.h"
+
+#include <cstdlib>
+
+/* index of the smallest class whose blocks hold size bytes, -1 if none */
+static int size_class_index(size_t size)
+{
+    int shift = FRAME_POOL_MIN_SHIFT;
+    while (shift <= FRAME_POOL_MAX_SHIFT && ((size_t)1 << shift) < size)
+    {
+        shift++;
+    }
+    return shift <= FRAME_POOL_MAX_SHIFT ? shift - FRAME_POOL_MIN_SHIFT : -1;
+}
+
+/* never destroyed, buffers in flight may give blocks back during exit */
+FramePool& FramePool::instance()
+{
+    static FramePool* pool = new FramePool();
+    return *pool;
+}
+
+void* FramePool::allocate(size_t size)
+{
+    int index = size_class_index(size);
+
+    allocs_++;
+
+    if (index < 0)
+    {
+        oversize_++;
+        void* ptr = malloc(size);
+        if (!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    SizeClass& sc    = classes_[index];
+    size_t     block = (size_t)1 << (index + FRAME_POOL_MIN_SHIFT);
+
+    std::lock_guard<std::mutex> guard(sc.lock);
+
+    if (sc.free_list)
+    {
+        FreeBlock* head = sc.free_list;
+        sc.free_list = head->next;
+        hits_++;
+        return head;
+    }
+
+    if (sc.slab_cur == sc.slab_end)
+    {
+        /* small blocks are carved from a shared slab size, large ones two at a time */
+        size_t slab_size = block <= FRAME_POOL_SLAB_SIZE / 4 ? FRAME_POOL_SLAB_SIZE : block * 2;
+        char*  slab      = (char*)malloc(slab_size);
+        if (!slab)
+        {
+            throw std::bad_alloc();
+        }
+
+        sc.slabs.push_back(slab);
+        sc.slab_cur = slab;
+        sc.slab_end = slab + slab_size;
+        slab_bytes_ += slab_size;
+    }
+
+    void* ptr = sc.slab_cur;
+    sc.slab_cur += block;
+    misses_++;
+    return ptr;
+}
+
+void FramePool::deallocate(void* ptr, size_t size)
+{
+    int index = size_class_index(size);
+
+    if (!ptr)
+    {
+        return;
+    }
+
+    frees_++;
+
+    if (index < 0)
+    {
+        free(ptr);
+        return;
+    }
+
+    SizeClass& sc = classes_[index];
+    std::lock_guard<std::mutex> guard(sc.lock);
+
+    FreeBlock* head = (FreeBlock*)ptr;
+    head->next   = sc.free_list;
+    sc.free_list = head;
+}
+
+FramePoolStats FramePool::stats() const
+{
+    FramePoolStats stats;
+
+    stats.allocs     = allocs_;
+    stats.frees      = frees_;
+    stats.hits       = hits_;
+    stats.misses     = misses_;
+    stats.oversize   = oversize_;
+    stats.slab_bytes = slab_bytes_;
+    return stats;
+}
+
+
+struct FrameBufferPool
+{
+    GstBufferPool parent;
+};
+
+struct FrameBufferPoolClass
+{
+    GstBufferPoolClass parent_class;
+};
+
+G_DEFINE_TYPE(FrameBufferPool, frame_buffer_pool, GST_TYPE_BUFFER_POOL);
+
+static std::atomic<guint64> frame_buffers {0};
+
+static GstFlowReturn frame_buffer_pool_alloc(GstBufferPool* pool, GstBuffer** buffer,
+                                             GstBufferPoolAcquireParams* params)
+{
+    *buffer = gst_buffer_new();
+    frame_buffers++;
+    return GST_FLOW_OK;
+}
+
+/* the pool only takes back untouched buffers, drop the frame and the
+ * memory tag the append left */
+static void frame_buffer_pool_reset(GstBufferPool* pool, GstBuffer* buffer)
+{
+    gst_buffer_remove_all_memory(buffer);
+    GST_BUFFER_POOL_CLASS(frame_buffer_pool_parent_class)->reset_buffer(pool, buffer);
+    GST_BUFFER_FLAG_UNSET(buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+}
+
+static void frame_buffer_pool_class_init(FrameBufferPoolClass* klass)
+{
+    GstBufferPoolClass* pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+    pool_class->alloc_buffer = frame_buffer_pool_alloc;
+    pool_class->reset_buffer = frame_buffer_pool_reset;
+}
+
+static void frame_buffer_pool_init(FrameBufferPool* pool)
+{
+}
+
+static GstBufferPool* frame_buffer_pool_create()
+{
+    GstBufferPool* pool   = (GstBufferPool*)g_object_new(frame_buffer_pool_get_type(), NULL);
+    GstStructure*  config = NULL;
+
+    gst_object_ref_sink(pool);
+
+    /* no memory of its own, no upper bound */
+    config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, NULL, 0, 0, 0);
+    gst_buffer_pool_set_config(pool, config);
+    gst_buffer_pool_set_active(pool, TRUE);
+    return pool;
+}
+
+/* never destroyed either, buffers in flight come back during exit */
+GstBuffer* frame_buffer_acquire()
+{
+    static GstBufferPool* pool = frame_buffer_pool_create();
+    GstBuffer* buffer = NULL;
+
+    if (gst_buffer_pool_acquire_buffer(pool, &buffer, NULL) != GST_FLOW_OK)
+    {
+        return gst_buffer_new();
+    }
+    return buffer;
+}
+
+guint64 frame_buffer_allocated()
+{
+    return frame_buffers;
+}
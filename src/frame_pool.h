@@ -0,0 +1,119 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <gst/gst.h>
+
+/**
+ * size-classed slab pool for per-frame allocations.
+ *
+ * blocks are powers of two from FRAME_POOL_MIN_BLOCK to FRAME_POOL_MAX_BLOCK,
+ * carved from slabs that are never handed back to the heap, freed blocks go to
+ * a per-class free list. once the pool is warm, the pool itself does not
+ * touch malloc. larger requests fall through to malloc and are counted as
+ * oversize.
+ *
+ * the slabs live as long as the process, the pool is a singleton that is
+ * never destroyed.
+ * */
+
+#define FRAME_POOL_MIN_SHIFT    5           // 32 bytes
+#define FRAME_POOL_MAX_SHIFT    22          // 4 MB
+#define FRAME_POOL_SLAB_SIZE    (256 * 1024)
+
+struct FramePoolStats
+{
+    uint64_t allocs     = 0;    // blocks handed out
+    uint64_t frees      = 0;    // blocks given back
+    uint64_t hits       = 0;    // served from a free list
+    uint64_t misses     = 0;    // carved from a slab
+    uint64_t oversize   = 0;    // too large for any class, went to malloc
+    uint64_t slab_bytes = 0;    // memory held by slabs
+};
+
+class FramePool
+{
+public:
+    static FramePool& instance();
+
+    void* allocate(size_t size);
+    void  deallocate(void* ptr, size_t size);
+
+    FramePoolStats stats() const;
+
+private:
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct SizeClass
+    {
+        std::mutex         lock;
+        FreeBlock*         free_list = nullptr;
+        char*              slab_cur  = nullptr;
+        char*              slab_end  = nullptr;
+        std::vector<void*> slabs;
+    };
+
+    static const int kClasses = FRAME_POOL_MAX_SHIFT - FRAME_POOL_MIN_SHIFT + 1;
+
+    SizeClass classes_[kClasses];
+
+    std::atomic<uint64_t> allocs_     {0};
+    std::atomic<uint64_t> frees_      {0};
+    std::atomic<uint64_t> hits_       {0};
+    std::atomic<uint64_t> misses_     {0};
+    std::atomic<uint64_t> oversize_   {0};
+    std::atomic<uint64_t> slab_bytes_ {0};
+};
+
+/* std allocator on top of FramePool, meant for std::allocate_shared so the
+ * object and its control block come from one pooled block */
+template <class T>
+struct FramePoolAllocator
+{
+    using value_type = T;
+
+    FramePoolAllocator() = default;
+
+    template <class U>
+    FramePoolAllocator(const FramePoolAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        return (T*)FramePool::instance().allocate(n * sizeof(T));
+    }
+
+    void deallocate(T* ptr, size_t n)
+    {
+        FramePool::instance().deallocate(ptr, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const FramePoolAllocator<T>&, const FramePoolAllocator<U>&) { return true; }
+
+template <class T, class U>
+bool operator!=(const FramePoolAllocator<T>&, const FramePoolAllocator<U>&) { return false; }
+
+/**
+ * empty GstBuffers recycled for wrapping frames. a buffer coming back drops
+ * the memory it wrapped, which releases the frame, and is handed out again.
+ * per frame only the GstMemory of the wrapped payload is still allocated.
+ * */
+GstBuffer* frame_buffer_acquire();
+
+/* GstBuffers the pool created so far, flat once it is warm */
+guint64 frame_buffer_allocated();
+
+#endif // FRAME_POOL_H
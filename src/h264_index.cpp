@@ -0,0 +1,393 @@
+#include "h264_index.h"
+#include "h264_nal.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define H264_INDEX_MAGIC    "H264IDX4"
+#define H264_INDEX_VERSION  4
+#define H264_MAX_REORDER    16          // frames, the largest DPB
+#define H264_INDEX_SUFFIX   ".idx"
+
+/* sidecar layout : header, frame_count entries, keyframe_count frame numbers,
+ * native byte order. every section stays 8 byte aligned within the mapping */
+struct H264IndexHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t file_size;         // the sidecar is stale once the file changed
+    int64_t  file_mtime;
+    int64_t  frame_duration;
+    int64_t  reorder_delay;
+    uint64_t frame_count;
+    uint64_t keyframe_count;
+};
+
+/* builds whose sidecar could not be written, by file path. never evicted,
+ * an index in use keeps its data even after the file changed */
+struct H264IndexCached
+{
+    uint64_t                             file_size;
+    int64_t                              file_mtime;
+    int64_t                              frame_duration;
+    int64_t                              reorder_delay;
+    std::shared_ptr<const H264IndexData> data;
+};
+
+static std::mutex                             g_cache_lock;
+static std::map<std::string, H264IndexCached> g_cache;
+
+H264Index::~H264Index()
+{
+    if (map)
+    {
+        munmap(map, map_size);
+    }
+}
+
+/**
+ * picture order count of every slice, POC type 0 as in 8.2.1.1. the MSB
+ * follows the previous reference picture and restarts at each IDR. other
+ * POC types and slices whose parameter sets are unknown count in decode
+ * order, i.e. without reordering
+ * */
+struct H264PocState
+{
+    H264ParamSets sets;
+    int64_t       prev_msb = 0;
+    uint32_t      prev_lsb = 0;
+};
+
+static int64_t h264_index_poc(H264PocState* state, const uint8_t* au, size_t au_size,
+                              const H264AuInfo& info, int64_t decode_poc)
+{
+    H264SlicePoc poc;
+
+    if (info.sps.data || info.pps.data)
+    {
+        h264_param_sets_update(&state->sets, au, au_size);
+    }
+    if (info.is_idr)
+    {
+        state->prev_msb = 0;
+        state->prev_lsb = 0;
+    }
+    if (!h264_slice_parse_poc(info.slice.data, info.slice.size, &state->sets, &poc) || poc.poc_type != 0)
+    {
+        return decode_poc;
+    }
+
+    int64_t msb  = state->prev_msb;
+    int64_t half = poc.max_poc_lsb / 2;
+    if (poc.poc_lsb < state->prev_lsb && (int64_t)(state->prev_lsb - poc.poc_lsb) >= half)
+    {
+        msb += poc.max_poc_lsb;
+    }
+    else if (poc.poc_lsb > state->prev_lsb && (int64_t)(poc.poc_lsb - state->prev_lsb) > half)
+    {
+        msb -= poc.max_poc_lsb;
+    }
+    if (poc.reference)
+    {
+        state->prev_msb = msb;
+        state->prev_lsb = poc.poc_lsb;
+    }
+    return msb + poc.poc_lsb;
+}
+
+/* display position of frames [first, last) within their GOP, by POC */
+static void h264_index_rank(const std::vector<int64_t>& _pocs, size_t first, size_t last,
+                            std::vector<uint32_t>* ranks)
+{
+    std::vector<uint32_t> order(last - first);
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = (uint32_t)i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return _pocs[first + a] < _pocs[first + b];
+    });
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        (*ranks)[first + order[i]] = (uint32_t)i;
+    }
+}
+
+/* point the index at shared scan data */
+static void h264_index_set(H264Index* index, const std::shared_ptr<const H264IndexData>& _data,
+                           int64_t frame_duration, int64_t reorder_delay)
+{
+    index->owned          = _data;
+    index->frame_duration = frame_duration;
+    index->reorder_delay  = reorder_delay;
+    index->frames         = _data->frames.data();
+    index->frame_count    = _data->frames.size();
+    index->keyframes      = _data->keyframes.data();
+    index->keyframe_count = _data->keyframes.size();
+}
+
+void h264_index_build(const uint8_t* data, size_t size, int64_t frame_duration, H264Index* index)
+{
+    std::shared_ptr<H264IndexData> owned  = std::make_shared<H264IndexData>();
+    std::vector<H264IndexEntry>&   frames = owned->frames;
+    std::vector<uint32_t>&         keys   = owned->keyframes;
+    H264PocState                   state;
+    std::vector<int64_t>           pocs;
+    size_t                         pos    = 0;
+    size_t                         gop    = 0;    // first frame of the current GOP
+
+    while (pos < size)
+    {
+        size_t     au_size = h264_au_size(data + pos, size - pos);
+        H264AuInfo info;
+
+        h264_au_parse(data + pos, au_size, &info);
+        if (info.has_slice)
+        {
+            H264IndexEntry entry;
+            entry.offset = pos;
+            entry.size   = (uint32_t)au_size;
+            entry.flags  = (info.is_idr   ? H264_INDEX_IDR : 0) |
+                           (info.sps.data ? H264_INDEX_SPS : 0) |
+                           (info.pps.data ? H264_INDEX_PPS : 0);
+            entry.dts    = (int64_t)frames.size() * frame_duration;
+            entry.pts    = entry.dts;
+
+            if (info.is_idr)
+            {
+                gop = frames.size();
+                keys.push_back((uint32_t)frames.size());
+            }
+
+            /* frame POCs count in steps of 2, decode order does the same */
+            pocs.push_back(h264_index_poc(&state, data + pos, au_size, info,
+                                          2 * (int64_t)(frames.size() - gop)));
+            frames.push_back(entry);
+        }
+        pos += au_size;
+    }
+
+    /* rank every GOP, the frames in front of the first IDR form one as well */
+    std::vector<uint32_t> ranks(frames.size());
+    std::vector<size_t>   starts(keys.begin(), keys.end());
+    if (starts.empty() || starts.front() != 0)
+    {
+        starts.insert(starts.begin(), 0);
+    }
+    starts.push_back(frames.size());
+    for (size_t k = 0; k + 1 < starts.size(); k++)
+    {
+        h264_index_rank(pocs, starts[k], starts[k + 1], &ranks);
+    }
+
+    /* the deepest reordering : how many slots ahead of its decode time a
+     * frame is due, every pts is shifted by that so none precedes its dts */
+    int64_t delay = 0;
+    for (size_t k = 0; k + 1 < starts.size(); k++)
+    {
+        for (size_t n = starts[k]; n < starts[k + 1]; n++)
+        {
+            delay = std::max(delay, (int64_t)(n - starts[k]) - (int64_t)ranks[n]);
+        }
+    }
+    delay = std::min(delay, (int64_t)H264_MAX_REORDER);
+
+    for (size_t k = 0; k + 1 < starts.size(); k++)
+    {
+        for (size_t n = starts[k]; n < starts[k + 1]; n++)
+        {
+            int64_t slot = (int64_t)(starts[k] + ranks[n]) + delay;
+            frames[n].pts = std::max(slot * frame_duration, frames[n].dts);
+        }
+    }
+
+    h264_index_set(index, owned, frame_duration, delay * frame_duration);
+}
+
+static bool h264_index_map(const std::string& _sidecar, const struct stat& _st,
+                           int64_t frame_duration, H264Index* index)
+{
+    int         fd = open(_sidecar.c_str(), O_RDONLY);
+    struct stat st;
+    void*       map;
+
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(H264IndexHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const H264IndexHeader* header = (const H264IndexHeader*)map;
+    size_t expected = sizeof(H264IndexHeader) +
+        header->frame_count * sizeof(H264IndexEntry) + header->keyframe_count * sizeof(uint32_t);
+
+    if (memcmp(header->magic, H264_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version        != H264_INDEX_VERSION ||
+        header->entry_size     != sizeof(H264IndexEntry) ||
+        header->file_size      != (uint64_t)_st.st_size ||
+        header->file_mtime     != (int64_t)_st.st_mtime ||
+        header->frame_duration != frame_duration ||
+        expected               != (size_t)st.st_size)
+    {
+        munmap(map, (size_t)st.st_size);
+        return false;
+    }
+
+    index->map            = map;
+    index->map_size       = (size_t)st.st_size;
+    index->frame_duration = header->frame_duration;
+    index->reorder_delay  = header->reorder_delay;
+    index->frames         = (const H264IndexEntry*)(header + 1);
+    index->frame_count    = header->frame_count;
+    index->keyframes      = (const uint32_t*)(index->frames + index->frame_count);
+    index->keyframe_count = header->keyframe_count;
+    return true;
+}
+
+/* written to a temporary file and renamed, a reader never sees half a sidecar */
+static bool h264_index_save(const std::string& _sidecar, const struct stat& _st, const H264Index* index)
+{
+    std::string     tmp  = _sidecar + ".tmp";
+    FILE*           file = fopen(tmp.c_str(), "wb");
+    H264IndexHeader header;
+    bool            ok;
+
+    if (!file)
+    {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, H264_INDEX_MAGIC, sizeof(header.magic));
+    header.version        = H264_INDEX_VERSION;
+    header.entry_size     = sizeof(H264IndexEntry);
+    header.file_size      = (uint64_t)_st.st_size;
+    header.file_mtime     = (int64_t)_st.st_mtime;
+    header.frame_duration = index->frame_duration;
+    header.reorder_delay  = index->reorder_delay;
+    header.frame_count    = index->frame_count;
+    header.keyframe_count = index->keyframe_count;
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(index->frames, sizeof(H264IndexEntry), index->frame_count, file) == index->frame_count &&
+         fwrite(index->keyframes, sizeof(uint32_t), index->keyframe_count, file) == index->keyframe_count;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), _sidecar.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/* stat of the file, zeroed if it is gone so no sidecar matches */
+static void h264_index_stat(const char* path, struct stat* st)
+{
+    if (stat(path, st) != 0)
+    {
+        memset(st, 0, sizeof(*st));
+    }
+}
+
+static bool h264_index_load_stat(const char* path, const struct stat& _st,
+                                 int64_t frame_duration, H264Index* index)
+{
+    std::string sidecar = std::string(path) + H264_INDEX_SUFFIX;
+
+    if (h264_index_map(sidecar, _st, frame_duration, index))
+    {
+        printf("index %s: %u frames, %u keyframes\n", sidecar.c_str(),
+            (unsigned)index->frame_count, (unsigned)index->keyframe_count);
+        return true;
+    }
+
+    std::lock_guard<std::mutex> guard(g_cache_lock);
+    auto it = g_cache.find(path);
+    if (it == g_cache.end() ||
+        it->second.file_size      != (uint64_t)_st.st_size ||
+        it->second.file_mtime     != (int64_t)_st.st_mtime ||
+        it->second.frame_duration != frame_duration)
+    {
+        return false;
+    }
+    h264_index_set(index, it->second.data, it->second.frame_duration, it->second.reorder_delay);
+    return true;
+}
+
+bool h264_index_load(const char* path, int64_t frame_duration, H264Index* index)
+{
+    struct stat st;
+
+    h264_index_stat(path, &st);
+    return h264_index_load_stat(path, st, frame_duration, index);
+}
+
+bool h264_index_open(const char* path, const uint8_t* data, size_t size,
+                     int64_t frame_duration, H264Index* index)
+{
+    std::string sidecar = std::string(path) + H264_INDEX_SUFFIX;
+    struct stat st;
+
+    h264_index_stat(path, &st);
+    if (h264_index_load_stat(path, st, frame_duration, index))
+    {
+        return index->keyframe_count > 0;
+    }
+
+    h264_index_build(data, size, frame_duration, index);
+    printf("indexed %s: %u frames, %u keyframes\n", path,
+        (unsigned)index->frame_count, (unsigned)index->keyframe_count);
+
+    if (!h264_index_save(sidecar, st, index))
+    {
+        printf("write index %s failed, kept in memory\n", sidecar.c_str());
+
+        std::lock_guard<std::mutex> guard(g_cache_lock);
+        g_cache[path] = { (uint64_t)st.st_size, (int64_t)st.st_mtime,
+                          index->frame_duration, index->reorder_delay, index->owned };
+    }
+    return index->keyframe_count > 0;
+}
+
+size_t h264_index_find(const H264Index* index, int64_t pts)
+{
+    size_t lo = 0;
+    size_t hi = index->keyframe_count;
+
+    /* first keyframe after pts */
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->keyframe(mid).pts <= pts)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
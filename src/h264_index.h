@@ -0,0 +1,94 @@
+#ifndef H264_INDEX_H
+#define H264_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * frame index of an Annex-B H.264 file : byte offset, size, flags and time
+ * of every access unit, plus the positions of the IDR frames among them.
+ *
+ * it is built by one scan over the mapped file and written to a sidecar file
+ * next to it (<file>.idx). later opens map the sidecar and use its entries in
+ * place, so opening a source costs the same for any file length. a build
+ * whose sidecar cannot be written (read-only directory) is kept in memory
+ * instead, for the lifetime of the process, and later opens share it.
+ *
+ * raw streams carry no timestamps, access unit n is decoded at
+ * n * frame_duration, the same way the raw demuxer stamps them. the
+ * presentation time follows the picture order count of the slices : frames
+ * are ranked by POC within their GOP and the whole stream is shifted by the
+ * deepest reordering seen, so that pts >= dts holds for B-frames as well.
+ * streams without POC reordering get pts == dts.
+ * */
+enum H264IndexFlags
+{
+    H264_INDEX_IDR        = 1 << 0,
+    H264_INDEX_SPS        = 1 << 1,     // in-band SPS in front of the slices
+    H264_INDEX_PPS        = 1 << 2,     // in-band PPS in front of the slices
+};
+
+struct H264IndexEntry
+{
+    uint64_t offset;        // first byte of the access unit, incl. its AUD/SPS/PPS
+    uint32_t size;
+    uint32_t flags;
+    int64_t  dts;           // ns
+    int64_t  pts;           // ns
+};
+
+/* entries of a scan, shared by the indexes opened from it */
+struct H264IndexData
+{
+    std::vector<H264IndexEntry> frames;
+    std::vector<uint32_t>       keyframes;
+};
+
+struct H264Index
+{
+    H264Index() = default;
+    ~H264Index();
+
+    H264Index(const H264Index&) = delete;
+    H264Index& operator=(const H264Index&) = delete;
+
+    int64_t               frame_duration = 0;       // ns
+    int64_t               reorder_delay  = 0;       // ns, pts - dts of the keyframes
+    const H264IndexEntry* frames         = nullptr;
+    size_t                frame_count    = 0;
+    const uint32_t*       keyframes      = nullptr; // frame numbers of the IDR frames
+    size_t                keyframe_count = 0;
+
+    /* entries point into the mapped sidecar, or into the data of a scan */
+    void*                                map      = nullptr;
+    size_t                               map_size = 0;
+    std::shared_ptr<const H264IndexData> owned;
+
+    int64_t duration() const { return (int64_t)frame_count * frame_duration + reorder_delay; }
+    const H264IndexEntry& keyframe(size_t k) const { return frames[keyframes[k]]; }
+};
+
+/* scan the mapped stream */
+void h264_index_build(const uint8_t* data, size_t size, int64_t frame_duration, H264Index* index);
+
+/**
+ * @brief map the sidecar of path, or build the index and write the sidecar
+ * @param data  the mapped file
+ * @return false if there is no keyframe at all
+ * */
+bool h264_index_open(const char* path, const uint8_t* data, size_t size,
+                     int64_t frame_duration, H264Index* index);
+
+/**
+ * @brief the index of path without scanning : the sidecar if it is up to
+ *        date, else what an earlier open of the unchanged file kept in memory
+ * @return false if there is neither, the file needs h264_index_open first
+ * */
+bool h264_index_load(const char* path, int64_t frame_duration, H264Index* index);
+
+/* position in keyframes of the last keyframe at or before pts, the first one before it */
+size_t h264_index_find(const H264Index* index, int64_t pts);
+
+#endif // H264_INDEX_H
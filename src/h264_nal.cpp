@@ -0,0 +1,605 @@
+#include "h264_nal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static inline bool is_vcl_nal(uint8_t type)
+{
+    return type >= H264_NAL_SLICE && type <= H264_NAL_SLICE_IDR;
+}
+
+static const uint8_t* find_start_code_c(const uint8_t* p, const uint8_t* end)
+{
+    for (; end - p >= 3; p++)
+    {
+        if (p[2] > 1)
+        {
+            p += 2;     // none of p..p+2 can start a start code
+        }
+        else if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+/**
+ * compare three shifted loads against 00 00 01 at once, the masks have bit i
+ * set when p[i], p[i+1], p[i+2] match, so the first set bit is the result.
+ * both scan while a full vector plus the two shifted bytes fit and leave the
+ * rest to the caller, *p is where they stopped.
+ * */
+#if defined(__x86_64__) || defined(__i386__)
+#define H264_NAL_AVX2_DISPATCH 1
+
+__attribute__((target("avx2")))
+static const uint8_t* find_start_code_avx2(const uint8_t** pp, const uint8_t* end)
+{
+    const uint8_t* p      = *pp;
+    const __m256i  zero32 = _mm256_setzero_si256();
+    const __m256i  one32  = _mm256_set1_epi8(1);
+
+    while (end - p >= 32 + 2)
+    {
+        __m256i  v0    = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t zeros = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, zero32));
+        if (zeros)
+        {
+            __m256i  v1   = _mm256_loadu_si256((const __m256i*)(p + 1));
+            __m256i  v2   = _mm256_loadu_si256((const __m256i*)(p + 2));
+            uint32_t mask = zeros
+                & (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, zero32))
+                & (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v2, one32));
+            if (mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        p += 32;
+    }
+    *pp = p;
+    return nullptr;
+}
+#endif
+
+#if defined(__SSE2__)
+static const uint8_t* find_start_code_sse2(const uint8_t** pp, const uint8_t* end)
+{
+    const uint8_t* p      = *pp;
+    const __m128i  zero16 = _mm_setzero_si128();
+    const __m128i  one16  = _mm_set1_epi8(1);
+
+    while (end - p >= 16 + 2)
+    {
+        __m128i  v0    = _mm_loadu_si128((const __m128i*)p);
+        uint32_t zeros = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, zero16));
+        if (zeros)
+        {
+            __m128i  v1   = _mm_loadu_si128((const __m128i*)(p + 1));
+            __m128i  v2   = _mm_loadu_si128((const __m128i*)(p + 2));
+            uint32_t mask = zeros
+                & (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, zero16))
+                & (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v2, one16));
+            if (mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        p += 16;
+    }
+    *pp = p;
+    return nullptr;
+}
+#endif
+
+/* the build only assumes the baseline ISA, AVX2 is picked at run time */
+const uint8_t* h264_find_start_code(const uint8_t* p, const uint8_t* end)
+{
+    const uint8_t* found = nullptr;
+
+#if defined(H264_NAL_AVX2_DISPATCH)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+
+    if (has_avx2 && (found = find_start_code_avx2(&p, end)))
+    {
+        return found;
+    }
+#endif
+
+#if defined(__SSE2__)
+    if ((found = find_start_code_sse2(&p, end)))
+    {
+        return found;
+    }
+#endif
+
+    return find_start_code_c(p, end);
+}
+
+void h264_nal_reader_init(H264NalReader* reader, const uint8_t* data, size_t size)
+{
+    reader->begin = data;
+    reader->cur   = data;
+    reader->end   = data + size;
+}
+
+/* a zero byte in front of 00 00 01 makes it a 4 byte start code */
+static inline const uint8_t* start_code_begin(const H264NalReader* reader, const uint8_t* sc)
+{
+    return (sc > reader->begin && sc[-1] == 0) ? sc - 1 : sc;
+}
+
+bool h264_nal_reader_next(H264NalReader* reader, H264Nal* nal)
+{
+    const uint8_t* sc = h264_find_start_code(reader->cur, reader->end);
+    if (reader->end - sc <= 3)
+    {
+        reader->cur = reader->end;
+        return false;
+    }
+
+    const uint8_t* data = sc + 3;
+    const uint8_t* next = h264_find_start_code(data, reader->end);
+    const uint8_t* last = next;
+
+    /* trailing zero bytes belong to the next start code (or are padding) */
+    if (next != reader->end)
+    {
+        last = start_code_begin(reader, next);
+    }
+    while (last > data && last[-1] == 0)
+    {
+        last--;
+    }
+
+    nal->start = start_code_begin(reader, sc);
+    nal->data  = data;
+    nal->size  = (uint32_t)(last - data);
+    nal->type  = data[0] & 0x1f;
+
+    reader->cur = next;
+    return true;
+}
+
+void h264_au_parse(const uint8_t* data, size_t size, H264AuInfo* info)
+{
+    H264NalReader reader;
+    const uint8_t* sc;
+
+    *info = H264AuInfo();
+    h264_nal_reader_init(&reader, data, size);
+
+    while (reader.end - (sc = h264_find_start_code(reader.cur, reader.end)) > 3)
+    {
+        uint8_t type = sc[3] & 0x1f;
+
+        /* parameter sets and SEI precede the slices of an access unit, stop
+         * at the first slice so the (large) slice data is never scanned */
+        if (is_vcl_nal(type))
+        {
+            info->has_slice   = true;
+            info->is_idr      = (type == H264_NAL_SLICE_IDR);
+            info->slice.start = sc;
+            info->slice.data  = sc + 3;
+            info->slice.size  = (uint32_t)(reader.end - info->slice.data);
+            info->slice.type  = type;
+            break;
+        }
+
+        H264Nal nal;
+        reader.cur = sc;
+        if (!h264_nal_reader_next(&reader, &nal))
+        {
+            break;
+        }
+
+        if (nal.type == H264_NAL_SPS || nal.type == H264_NAL_PPS)
+        {
+            if (nal.type == H264_NAL_SPS && !info->sps.data)
+            {
+                info->sps = nal;
+            }
+            if (nal.type == H264_NAL_PPS && !info->pps.data)
+            {
+                info->pps = nal;
+            }
+
+            if (!info->param_sets)
+            {
+                info->param_sets = nal.start;
+            }
+            info->param_sets_size = (uint32_t)(nal.data + nal.size - info->param_sets);
+        }
+    }
+}
+
+size_t h264_au_size(const uint8_t* data, size_t size)
+{
+    const uint8_t* end = data + size;
+    const uint8_t* sc  = h264_find_start_code(data, end);
+    bool seen_slice    = false;
+
+    /* the NAL header and the first payload byte must be there */
+    while (end - sc > 4)
+    {
+        uint8_t type = sc[3] & 0x1f;
+        bool    vcl  = is_vcl_nal(type);
+        /* partitions B / C (3, 4) open with slice_id, not first_mb_in_slice,
+         * they always follow their partition A */
+        bool    slice_head = type == H264_NAL_SLICE || type == H264_NAL_SLICE_DPA ||
+                             type == H264_NAL_SLICE_IDR;
+        bool    starts_au = vcl
+            ? slice_head && (sc[4] & 0x80) != 0     // ue(v) first_mb_in_slice == 0
+            : (type >= H264_NAL_SEI && type <= H264_NAL_AUD) || (type >= 14 && type <= 18);
+
+        if (seen_slice && starts_au)
+        {
+            return (size_t)(((sc > data && sc[-1] == 0) ? sc - 1 : sc) - data);
+        }
+        seen_slice = seen_slice || vcl;
+
+        sc = h264_find_start_code(sc + 3, end);
+    }
+
+    return size;
+}
+
+/**
+ * exp-golomb bit reader over the RBSP, emulation prevention bytes are
+ * dropped while the NAL is copied in. parameter sets are small, anything
+ * past H264_RBSP_MAX bytes reads as zero.
+ * */
+#define H264_RBSP_MAX 512
+
+struct BitReader
+{
+    uint8_t  rbsp[H264_RBSP_MAX];
+    size_t   size     = 0;
+    size_t   bit      = 0;
+    bool     overrun  = false;
+
+    BitReader(const uint8_t* nal, size_t nal_size)
+    {
+        int zeros = 0;
+        for (size_t i = 0; i < nal_size && size < H264_RBSP_MAX; i++)
+        {
+            if (zeros >= 2 && nal[i] == 3)
+            {
+                zeros = 0;
+                continue;
+            }
+            zeros = nal[i] == 0 ? zeros + 1 : 0;
+            rbsp[size++] = nal[i];
+        }
+    }
+
+    uint32_t u(int n)
+    {
+        uint32_t value = 0;
+        while (n--)
+        {
+            uint32_t b = 0;
+            if (bit < size * 8)
+            {
+                b = (rbsp[bit >> 3] >> (7 - (bit & 7))) & 1;
+            }
+            else
+            {
+                overrun = true;
+            }
+            value = (value << 1) | b;
+            bit++;
+        }
+        return value;
+    }
+
+    uint32_t ue()
+    {
+        int leading = 0;
+        while (u(1) == 0 && leading < 32 && !overrun)
+        {
+            leading++;
+        }
+        if (leading >= 32)
+        {
+            overrun = true;
+            return 0;
+        }
+        return ((1u << leading) - 1) + u(leading);
+    }
+
+    int32_t se()
+    {
+        uint32_t v = ue();
+        return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+    }
+};
+
+static void skip_scaling_list(BitReader* br, int size)
+{
+    int last_scale = 8;
+    int next_scale = 8;
+
+    for (int j = 0; j < size; j++)
+    {
+        if (next_scale != 0)
+        {
+            next_scale = (last_scale + br->se() + 256) % 256;
+        }
+        last_scale = next_scale == 0 ? last_scale : next_scale;
+    }
+}
+
+bool h264_sps_parse(const uint8_t* nal, size_t size, H264Sps* sps)
+{
+    if (size < 4 || (nal[0] & 0x1f) != H264_NAL_SPS)
+    {
+        return false;
+    }
+
+    BitReader br(nal + 1, size - 1);
+    uint32_t  chroma_format_idc = 1;
+    uint32_t  separate_colour_plane = 0;
+
+    *sps = H264Sps();
+    sps->profile_idc = (uint8_t)br.u(8);
+    br.u(8);                                        // constraint flags
+    sps->level_idc   = (uint8_t)br.u(8);
+    sps->sps_id      = br.ue();
+
+    switch (sps->profile_idc)
+    {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83:  case 86:  case 118: case 128: case 138:
+    case 139: case 134: case 135:
+        chroma_format_idc = br.ue();
+        if (chroma_format_idc == 3)
+        {
+            separate_colour_plane = br.u(1);
+        }
+        br.ue();                                    // bit_depth_luma_minus8
+        br.ue();                                    // bit_depth_chroma_minus8
+        br.u(1);                                    // qpprime_y_zero_transform_bypass
+        if (br.u(1))                                // seq_scaling_matrix_present
+        {
+            int lists = chroma_format_idc != 3 ? 8 : 12;
+            for (int i = 0; i < lists; i++)
+            {
+                if (br.u(1))
+                {
+                    skip_scaling_list(&br, i < 6 ? 16 : 64);
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    sps->separate_colour_plane = separate_colour_plane != 0;
+    sps->log2_max_frame_num    = br.ue() + 4;
+    sps->poc_type              = br.ue();
+    if (sps->poc_type == 0)
+    {
+        sps->log2_max_poc_lsb = br.ue() + 4;
+    }
+    else if (sps->poc_type == 1)
+    {
+        br.u(1);                                    // delta_pic_order_always_zero
+        br.se();                                    // offset_for_non_ref_pic
+        br.se();                                    // offset_for_top_to_bottom_field
+        uint32_t cycle = br.ue();
+        for (uint32_t i = 0; i < cycle && !br.overrun; i++)
+        {
+            br.se();
+        }
+    }
+
+    br.ue();                                        // max_num_ref_frames
+    br.u(1);                                        // gaps_in_frame_num_allowed
+    uint32_t width_mbs      = br.ue() + 1;
+    uint32_t height_map     = br.ue() + 1;
+    uint32_t frame_mbs_only = br.u(1);
+    sps->frame_mbs_only = frame_mbs_only != 0;
+    if (!frame_mbs_only)
+    {
+        br.u(1);                                    // mb_adaptive_frame_field
+    }
+    br.u(1);                                        // direct_8x8_inference
+
+    uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+    if (br.u(1))
+    {
+        crop_left   = br.ue();
+        crop_right  = br.ue();
+        crop_top    = br.ue();
+        crop_bottom = br.ue();
+    }
+
+    uint32_t chroma_array_type = separate_colour_plane ? 0 : chroma_format_idc;
+    uint32_t crop_unit_x = 1;
+    uint32_t crop_unit_y = 2 - frame_mbs_only;
+    if (chroma_array_type != 0)
+    {
+        crop_unit_x = chroma_format_idc == 3 ? 1 : 2;
+        crop_unit_y = (chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+    }
+
+    sps->width  = width_mbs * 16 - crop_unit_x * (crop_left + crop_right);
+    sps->height = (2 - frame_mbs_only) * height_map * 16 - crop_unit_y * (crop_top + crop_bottom);
+
+    if (br.u(1))                                    // vui_parameters_present
+    {
+        if (br.u(1))                                // aspect_ratio_info_present
+        {
+            if (br.u(8) == 255)                     // Extended_SAR
+            {
+                br.u(16);
+                br.u(16);
+            }
+        }
+        if (br.u(1))                                // overscan_info_present
+        {
+            br.u(1);
+        }
+        if (br.u(1))                                // video_signal_type_present
+        {
+            br.u(3);
+            br.u(1);
+            if (br.u(1))                            // colour_description_present
+            {
+                br.u(24);
+            }
+        }
+        if (br.u(1))                                // chroma_loc_info_present
+        {
+            br.ue();
+            br.ue();
+        }
+        sps->timing_info_present = br.u(1);
+        if (sps->timing_info_present)
+        {
+            sps->num_units_in_tick = br.u(32);
+            sps->time_scale        = br.u(32);
+            sps->fixed_frame_rate  = br.u(1);
+        }
+    }
+
+    return !br.overrun && sps->width && sps->height;
+}
+
+bool h264_pps_parse_ids(const uint8_t* nal, size_t size, uint32_t* pps_id, uint32_t* sps_id)
+{
+    if (size < 2 || (nal[0] & 0x1f) != H264_NAL_PPS)
+    {
+        return false;
+    }
+
+    BitReader br(nal + 1, size - 1);
+    *pps_id = br.ue();
+    *sps_id = br.ue();
+    return !br.overrun && *pps_id < H264_MAX_PPS && *sps_id < H264_MAX_SPS;
+}
+
+bool h264_slice_parse_poc(const uint8_t* nal, size_t size, const H264ParamSets* sets, H264SlicePoc* poc)
+{
+    if (size < 2 || !is_vcl_nal(nal[0] & 0x1f))
+    {
+        return false;
+    }
+
+    BitReader br(nal + 1, size - 1);
+    br.ue();                                        // first_mb_in_slice
+    br.ue();                                        // slice_type
+    uint32_t pps_id = br.ue();
+    uint32_t sps_id, id;
+    H264Sps  sps;
+
+    if (br.overrun || pps_id >= H264_MAX_PPS || sets->pps[pps_id].empty())
+    {
+        return false;
+    }
+    const std::string& pps = sets->pps[pps_id];
+    if (!h264_pps_parse_ids((const uint8_t*)pps.data(), pps.size(), &id, &sps_id) ||
+        sets->sps[sps_id].empty())
+    {
+        return false;
+    }
+    const std::string& sps_nal = sets->sps[sps_id];
+    if (!h264_sps_parse((const uint8_t*)sps_nal.data(), sps_nal.size(), &sps))
+    {
+        return false;
+    }
+
+    if (sps.separate_colour_plane)
+    {
+        br.u(2);                                    // colour_plane_id
+    }
+    br.u((int)sps.log2_max_frame_num);              // frame_num
+    if (!sps.frame_mbs_only && br.u(1))             // field_pic_flag
+    {
+        br.u(1);                                    // bottom_field_flag
+    }
+    if ((nal[0] & 0x1f) == H264_NAL_SLICE_IDR)
+    {
+        br.ue();                                    // idr_pic_id
+    }
+
+    *poc = H264SlicePoc();
+    poc->poc_type  = sps.poc_type;
+    poc->reference = (nal[0] & 0x60) != 0;
+    if (sps.poc_type == 0)
+    {
+        poc->poc_lsb     = br.u((int)sps.log2_max_poc_lsb);
+        poc->max_poc_lsb = 1u << sps.log2_max_poc_lsb;
+    }
+    return !br.overrun;
+}
+
+bool h264_param_sets_update(H264ParamSets* sets, const uint8_t* au, size_t size)
+{
+    H264NalReader  reader;
+    H264Nal        nal;
+    const uint8_t* sc;
+    bool           changed = false;
+
+    h264_nal_reader_init(&reader, au, size);
+
+    /* like h264_au_parse, stop in front of the first slice */
+    while (reader.end - (sc = h264_find_start_code(reader.cur, reader.end)) > 3 && !is_vcl_nal(sc[3] & 0x1f))
+    {
+        reader.cur = sc;
+        if (!h264_nal_reader_next(&reader, &nal))
+        {
+            break;
+        }
+
+        std::string* slot = nullptr;
+        H264Sps      sps;
+        uint32_t     pps_id, sps_id;
+
+        if (nal.type == H264_NAL_SPS && h264_sps_parse(nal.data, nal.size, &sps) && sps.sps_id < H264_MAX_SPS)
+        {
+            slot = &sets->sps[sps.sps_id];
+        }
+        else if (nal.type == H264_NAL_PPS && h264_pps_parse_ids(nal.data, nal.size, &pps_id, &sps_id))
+        {
+            slot = &sets->pps[pps_id];
+        }
+
+        if (slot && slot->compare(0, std::string::npos, (const char*)nal.data, nal.size) != 0)
+        {
+            slot->assign((const char*)nal.data, nal.size);
+            if (nal.type == H264_NAL_SPS)
+            {
+                sets->last_sps = (int)sps.sps_id;
+            }
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+std::string h264_param_sets_annexb(const H264ParamSets* sets)
+{
+    static const char start_code[4] = { 0, 0, 0, 1 };
+    std::string annexb;
+
+    for (const std::string& sps : sets->sps)
+    {
+        if (!sps.empty())
+        {
+            annexb.append(start_code, sizeof(start_code)).append(sps);
+        }
+    }
+    for (const std::string& pps : sets->pps)
+    {
+        if (!pps.empty())
+        {
+            annexb.append(start_code, sizeof(start_code)).append(pps);
+        }
+    }
+    return annexb;
+}
@@ -0,0 +1,170 @@
+#ifndef H264_NAL_H
+#define H264_NAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Annex-B (byte-stream) H.264 helpers : start code scanning, NAL splitting
+ * and access unit classification.
+ *
+ * start codes may be 3 (00 00 01) or 4 (00 00 00 01) bytes long, the scanner
+ * uses SSE2 when the compiler targets it, AVX2 when the CPU has it at run
+ * time, and falls back to plain C.
+ * */
+
+enum H264NalType
+{
+    H264_NAL_SLICE      = 1,
+    H264_NAL_SLICE_DPA  = 2,
+    H264_NAL_SLICE_IDR  = 5,
+    H264_NAL_SEI        = 6,
+    H264_NAL_SPS        = 7,
+    H264_NAL_PPS        = 8,
+    H264_NAL_AUD        = 9,
+};
+
+struct H264Nal
+{
+    const uint8_t* start = nullptr;     // first byte of the start code
+    const uint8_t* data  = nullptr;     // NAL header, first byte after the start code
+    uint32_t       size  = 0;           // NAL size without start code
+    uint8_t        type  = 0;
+
+    uint32_t start_code_len() const { return (uint32_t)(data - start); }
+    uint32_t total_size() const     { return start_code_len() + size; }
+};
+
+struct H264NalReader
+{
+    const uint8_t* begin = nullptr;
+    const uint8_t* cur   = nullptr;
+    const uint8_t* end   = nullptr;
+};
+
+/* access unit summary, scanning stops at the first slice so the slice data
+ * itself is never touched */
+struct H264AuInfo
+{
+    bool           is_idr          = false;
+    bool           has_slice       = false;
+    H264Nal        slice;                       // first slice, its size runs to the end of the unit
+    H264Nal        sps;                         // first SPS, data is null if there is none
+    H264Nal        pps;                         // first PPS, data is null if there is none
+    const uint8_t* param_sets      = nullptr;   // first SPS/PPS up to the end of the last one
+    uint32_t       param_sets_size = 0;         // before the first slice, incl. start codes
+};
+
+/* fields of a sequence parameter set the server cares about */
+struct H264Sps
+{
+    uint8_t  profile_idc         = 0;
+    uint8_t  level_idc           = 0;
+    uint32_t sps_id              = 0;
+    uint32_t width               = 0;   // after cropping
+    uint32_t height              = 0;
+    bool     timing_info_present = false;
+    uint32_t num_units_in_tick   = 0;
+    uint32_t time_scale          = 0;
+    bool     fixed_frame_rate    = false;
+
+    /* what a slice header needs to be read */
+    uint32_t log2_max_frame_num    = 4;
+    uint32_t poc_type              = 0;
+    uint32_t log2_max_poc_lsb      = 4;     // poc_type 0 only
+    bool     frame_mbs_only        = true;
+    bool     separate_colour_plane = false;
+
+    /* frame rate from the VUI timing info, false if the stream does not say */
+    bool framerate(uint32_t* num, uint32_t* den) const
+    {
+        if (!timing_info_present || !num_units_in_tick || !time_scale)
+        {
+            return false;
+        }
+        *num = time_scale;
+        *den = 2 * num_units_in_tick;
+        return true;
+    }
+};
+
+/* picture order count fields of a slice header */
+struct H264SlicePoc
+{
+    uint32_t poc_type    = 0;
+    uint32_t poc_lsb     = 0;               // poc_type 0 only
+    uint32_t max_poc_lsb = 0;
+    bool     reference   = false;           // nal_ref_idc != 0
+};
+
+#define H264_MAX_SPS 32
+#define H264_MAX_PPS 256
+
+/* parameter sets of a stream by id, a later set with the same id replaces
+ * the earlier one */
+struct H264ParamSets
+{
+    std::string sps[H264_MAX_SPS];      // NAL without start code, empty if not seen yet
+    std::string pps[H264_MAX_PPS];
+    int         last_sps = -1;          // id of the SPS that changed last
+};
+
+/**
+ * @brief find the next 00 00 01 sequence in [p, end)
+ * @return pointer to the first zero of the sequence, end if there is none
+ * */
+const uint8_t* h264_find_start_code(const uint8_t* p, const uint8_t* end);
+
+void h264_nal_reader_init(H264NalReader* reader, const uint8_t* data, size_t size);
+
+/**
+ * @brief split the next NAL off the byte stream
+ * @return false once there are no more NALs
+ * */
+bool h264_nal_reader_next(H264NalReader* reader, H264Nal* nal);
+
+/**
+ * @brief classify an access unit and locate its parameter sets
+ * */
+void h264_au_parse(const uint8_t* data, size_t size, H264AuInfo* info);
+
+/**
+ * @brief size of the access unit at the start of data
+ *
+ * the unit ends where the next one begins : an AUD, SEI or parameter set
+ * after a slice, or a slice with first_mb_in_slice 0. only start codes and
+ * the first byte of each NAL payload are looked at.
+ * @return bytes up to the start code of the next access unit, size for the last
+ * */
+size_t h264_au_size(const uint8_t* data, size_t size);
+
+/**
+ * @brief parse a sequence parameter set
+ * @param nal  NAL header and payload, without start code
+ * */
+bool h264_sps_parse(const uint8_t* nal, size_t size, H264Sps* sps);
+
+/**
+ * @brief read the ids of a picture parameter set
+ * @param nal  NAL header and payload, without start code
+ * */
+bool h264_pps_parse_ids(const uint8_t* nal, size_t size, uint32_t* pps_id, uint32_t* sps_id);
+
+/**
+ * @brief read the picture order count of a slice with the parameter sets it refers to
+ * @param nal  NAL header and slice header, without start code
+ * @return false if the slice refers to a set not seen yet
+ * */
+bool h264_slice_parse_poc(const uint8_t* nal, size_t size, const H264ParamSets* sets, H264SlicePoc* poc);
+
+/**
+ * @brief take the SPS/PPS in front of the first slice of an access unit
+ * @return true if a set was new or differs from the one stored for its id
+ * */
+bool h264_param_sets_update(H264ParamSets* sets, const uint8_t* au, size_t size);
+
+/* every stored set as Annex-B with 4 byte start codes, SPS first */
+std::string h264_param_sets_annexb(const H264ParamSets* sets);
+
+#endif // H264_NAL_H
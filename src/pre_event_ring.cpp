@@ -0,0 +1,260 @@
+#include "pre_event_ring.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define PRE_EVENT_WRAP      0xffffffffu     // rest of the arena unused, go on at 0
+#define PRE_EVENT_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+
+struct PreEventRecord
+{
+    uint32_t     size;          // payload bytes, PRE_EVENT_WRAP for the wrap mark
+    uint8_t      stream;
+    uint8_t      key;
+    uint16_t     reserved;
+    GstClockTime pts;
+};
+
+PreEventRing::PreEventRing(size_t bytes, GstClockTime window, RecordFeed* video, RecordFeed* audio)
+    : arena(PRE_EVENT_ALIGN(bytes)), window(window)
+{
+    feeds[PRE_EVENT_VIDEO] = video;
+    feeds[PRE_EVENT_AUDIO] = audio;
+}
+
+static PreEventGop& gop_at(PreEventRing* ring, size_t i)
+{
+    return ring->gops[(ring->gop_first + i) % PRE_EVENT_MAX_GOPS];
+}
+
+/* record at offset, past a wrap mark or a too short end of the arena */
+static size_t record_offset(PreEventRing* ring, size_t offset)
+{
+    if (ring->arena.size() - offset < sizeof(PreEventRecord) ||
+        ((PreEventRecord*)&ring->arena[offset])->size == PRE_EVENT_WRAP)
+    {
+        return 0;
+    }
+    return offset;
+}
+
+static void pre_event_ring_clear(PreEventRing* ring)
+{
+    ring->head      = 0;
+    ring->tail      = 0;
+    ring->gop_first = 0;
+    ring->gop_count = 0;
+}
+
+/* drop the oldest GOP, the ring then starts on the next keyframe */
+static void pre_event_ring_evict(PreEventRing* ring)
+{
+    ring->evicted++;
+    if (ring->gop_count <= 1)
+    {
+        pre_event_ring_clear(ring);
+        return;
+    }
+    ring->gop_first = (ring->gop_first + 1) % PRE_EVENT_MAX_GOPS;
+    ring->gop_count--;
+    ring->head = gop_at(ring, 0).offset;
+}
+
+/* contiguous room for need bytes behind tail, wrapping to 0 if the end is too short */
+static bool pre_event_ring_reserve(PreEventRing* ring, size_t need, size_t* offset)
+{
+    size_t capacity = ring->arena.size();
+
+    if (ring->gop_count == 0)
+    {
+        *offset = 0;
+        return need <= capacity;
+    }
+
+    if (ring->tail > ring->head)
+    {
+        if (capacity - ring->tail >= need)
+        {
+            *offset = ring->tail;
+            return true;
+        }
+        if (ring->head >= need)
+        {
+            if (capacity - ring->tail >= sizeof(uint32_t))
+            {
+                ((PreEventRecord*)&ring->arena[ring->tail])->size = PRE_EVENT_WRAP;
+            }
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    /* wrapped, or exactly full with tail == head */
+    if (ring->head - ring->tail >= need)
+    {
+        *offset = ring->tail;
+        return true;
+    }
+    return false;
+}
+
+static bool pre_event_ring_store(PreEventRing* ring, PreEventStream stream, const void* data, gsize size,
+                                 GstClockTime pts, bool key)
+{
+    bool   gop_start = (stream == PRE_EVENT_VIDEO && key);
+    size_t need      = sizeof(PreEventRecord) + PRE_EVENT_ALIGN(size);
+    size_t offset    = 0;
+
+    if (need > ring->arena.size())
+    {
+        ring->dropped++;
+        return false;
+    }
+    if (gop_start && ring->gop_count == PRE_EVENT_MAX_GOPS)
+    {
+        pre_event_ring_evict(ring);
+    }
+
+    while (!pre_event_ring_reserve(ring, need, &offset))
+    {
+        pre_event_ring_evict(ring);
+    }
+
+    /* frames in front of the first keyframe could not be decoded */
+    if (ring->gop_count == 0 && !gop_start)
+    {
+        ring->dropped++;
+        return false;
+    }
+
+    PreEventRecord* record = (PreEventRecord*)&ring->arena[offset];
+    record->size     = (uint32_t)size;
+    record->stream   = (uint8_t)stream;
+    record->key      = key ? 1 : 0;
+    record->reserved = 0;
+    record->pts      = pts;
+    memcpy(record + 1, data, size);
+
+    if (gop_start)
+    {
+        if (ring->gop_count == 0)
+        {
+            ring->head = offset;
+        }
+        gop_at(ring, ring->gop_count) = { offset, pts };
+        ring->gop_count++;
+    }
+    ring->tail = offset + need;
+
+    /* keep the newest GOP that still covers the whole window */
+    if (GST_CLOCK_TIME_IS_VALID(pts) && pts > ring->newest)
+    {
+        ring->newest = pts;
+    }
+    while (ring->gop_count >= 2 && GST_CLOCK_TIME_IS_VALID(gop_at(ring, 1).pts) &&
+           gop_at(ring, 1).pts + ring->window <= ring->newest)
+    {
+        pre_event_ring_evict(ring);
+    }
+    return true;
+}
+
+bool pre_event_ring_push(PreEventRing* ring, PreEventStream stream, const void* data, gsize size,
+                         GstClockTime pts, bool key)
+{
+    if (ring->live.load(std::memory_order_acquire))
+    {
+        return record_feed_push(ring->feeds[stream], data, size, pts, key);
+    }
+
+    std::lock_guard<std::mutex> guard(ring->lock);
+
+    /* triggered while this frame waited for the lock */
+    if (ring->live)
+    {
+        return record_feed_push(ring->feeds[stream], data, size, pts, key);
+    }
+    return pre_event_ring_store(ring, stream, data, size, pts, key);
+}
+
+bool pre_event_ring_trigger(PreEventRing* ring)
+{
+    size_t offset   = 0;
+    size_t tail     = 0;
+    size_t replayed = 0;
+    bool   empty    = true;
+
+    /* older frames still queued go into the appsrcs first */
+    record_feed_hold(ring->feeds[PRE_EVENT_VIDEO]);
+    record_feed_hold(ring->feeds[PRE_EVENT_AUDIO]);
+
+    {
+        std::lock_guard<std::mutex> guard(ring->lock);
+
+        if (ring->live)
+        {
+            record_feed_release(ring->feeds[PRE_EVENT_VIDEO]);
+            record_feed_release(ring->feeds[PRE_EVENT_AUDIO]);
+            return false;
+        }
+
+        /* from here on the producers pass through into the held feeds and
+         * leave the arena alone */
+        offset          = ring->head;
+        tail            = ring->tail;
+        empty           = ring->gop_count == 0;
+        ring->replaying = true;
+        ring->live      = true;
+    }
+
+    if (!empty)
+    {
+        do
+        {
+            offset = record_offset(ring, offset);
+
+            PreEventRecord* record = (PreEventRecord*)&ring->arena[offset];
+            record_feed_replay(ring->feeds[record->stream], record + 1, record->size,
+                               record->pts, record->key != 0);
+            offset += sizeof(PreEventRecord) + PRE_EVENT_ALIGN(record->size);
+            replayed++;
+        } while (offset != tail);
+    }
+
+    record_feed_release(ring->feeds[PRE_EVENT_VIDEO]);
+    record_feed_release(ring->feeds[PRE_EVENT_AUDIO]);
+
+    {
+        std::lock_guard<std::mutex> guard(ring->lock);
+        pre_event_ring_clear(ring);
+        ring->replaying = false;
+    }
+    ring->replayed.notify_all();
+
+    printf("[pre_event][replayed %u frames]\n", (unsigned)replayed);
+    return true;
+}
+
+void pre_event_ring_arm(PreEventRing* ring)
+{
+    std::unique_lock<std::mutex> guard(ring->lock);
+
+    ring->replayed.wait(guard, [ring]() { return !ring->replaying; });
+    pre_event_ring_clear(ring);
+    ring->newest = 0;
+    ring->live   = false;
+}
+
+void pre_event_ring_print_stats(const char* name, PreEventRing* ring)
+{
+    std::lock_guard<std::mutex> guard(ring->lock);
+    size_t used = ring->gop_count == 0   ? 0 :
+                  ring->tail > ring->head ? ring->tail - ring->head :
+                  ring->arena.size() - ring->head + ring->tail;
+
+    printf("[pre_event][%s %s gops:%u used:%u/%u evicted:%llu dropped:%llu]\n", name,
+        ring->live ? "live" : "armed", (unsigned)ring->gop_count,
+        (unsigned)used, (unsigned)ring->arena.size(),
+        (unsigned long long)ring->evicted, (unsigned long long)ring->dropped);
+}
@@ -0,0 +1,79 @@
+#ifndef PRE_EVENT_RING_H
+#define PRE_EVENT_RING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <gst/gst.h>
+
+#include "record_feed.h"
+
+#define PRE_EVENT_MAX_GOPS  256
+
+enum PreEventStream
+{
+    PRE_EVENT_VIDEO = 0,
+    PRE_EVENT_AUDIO = 1,
+};
+
+struct PreEventGop
+{
+    size_t       offset;        // first record of the GOP in the arena
+    GstClockTime pts;
+};
+
+/**
+ * the last seconds of a channel kept in memory while nothing is recorded.
+ *
+ * records (header + frame) of both streams are laid out back to back in one
+ * arena allocated up front, a record never wraps, the free end of the arena
+ * is skipped instead. the ring always starts on a video keyframe: whole GOPs
+ * are evicted from the front, once they are older than the window or to make
+ * room for a new record. nothing is allocated once the ring exists.
+ *
+ * on a trigger the ring is replayed into the feeds, oldest keyframe first,
+ * and the ring turns into a pass-through until it is armed again. the lock
+ * only guards the arena : the pass-through does not take it, and the replay
+ * reads the arena after letting go of it, nothing is stored while live. the
+ * feeds are held during the replay, live frames queue up behind it.
+ * */
+struct PreEventRing
+{
+    PreEventRing(size_t bytes, GstClockTime window, RecordFeed* video, RecordFeed* audio);
+
+    std::mutex           lock;
+    std::vector<uint8_t> arena;
+    size_t               head      = 0;         // oldest record
+    size_t               tail      = 0;         // where the next record goes
+    PreEventGop          gops[PRE_EVENT_MAX_GOPS];
+    size_t               gop_first = 0;
+    size_t               gop_count = 0;         // 0 : the ring is empty
+    GstClockTime         window;
+    GstClockTime         newest    = 0;
+    std::atomic<bool>    live      {false};     // triggered, frames go straight to the feeds
+    bool                 replaying = false;     // the arena is being read, arm waits
+    std::condition_variable replayed;
+    RecordFeed*          feeds[2];
+
+    guint64              evicted   = 0;         // GOPs
+    guint64              dropped   = 0;         // frames that did not fit or had no keyframe
+};
+
+/**
+ * @brief keep the frame, or hand it to its feed while the ring is live
+ * @param key only meaningful for video, audio frames are all keys
+ * @return false if the frame was dropped
+ * */
+bool pre_event_ring_push(PreEventRing* ring, PreEventStream stream, const void* data, gsize size,
+                         GstClockTime pts, bool key);
+
+/* replay the ring into the feeds and go live, false if it was live already */
+bool pre_event_ring_trigger(PreEventRing* ring);
+
+/* stop passing frames through and buffer again, after a replay in progress */
+void pre_event_ring_arm(PreEventRing* ring);
+
+void pre_event_ring_print_stats(const char* name, PreEventRing* ring);
+
+#endif // PRE_EVENT_RING_H
@@ -1,339 +1,359 @@
 #include <cstdio>
+#include <csignal>
+#include <map>
+#include <string>
 #include <gst/gst.h>
-#include <gst/app/gstappsrc.h>
+#include <glib-unix.h>
 
+#include "channel_manager.h"
 
-#define TAG "gst_record"
-
-#define GST_OBJECT_UNREF(element) \
-    if(element) {\
-        gst_object_unref(GST_OBJECT (element)); \
-    }
 
+#define TAG "gst_record"
 
-#define RECORD_AUDIO_RATE                   48000
-#define RECORD_AUDIO_CHANNEL                1
 #define RECORD_VIDEO_WIDTH                  1920
 #define RECORD_VIDEO_HEIGHT                 1080
 #define RECORD_VIDEO_FPS                    30
-#define RECORD_MAX_NSEC                     300*1000*1000*1000ULL
-#define RECORD_BYTES_PER_SEC                500
-#define RECORD_MOOV_UPDATE_PERIOD           1*1000*1000*1000
-
-static GstElement* g_pipeline     = nullptr;
-static GstElement* g_video_src    = nullptr;
-static GstElement* g_audio_src    = nullptr;
-static GstElement* g_h264_parse   = nullptr;
-static GstElement* g_faac         = nullptr;
-static GstElement* g_aac_parse    = nullptr;
-static GstElement* g_qtmux        = nullptr;
-static GstElement* g_splitmuxsink = nullptr;
-
-static int init_record_pipeline();
-
-static int need_audio_data_callback();
-static int enough_audio_data_callback();
-
-static int need_video_data_callback();
-static int enough_video_data_callback();
-
-static gchar* update_record_dest_callback(GstElement* object, 
-                                          guint       arg0, 
-                                          gpointer    user_data);
-
-static void splitmuxsink_muxer_added_callback(GstElement* object,
-                                              GstElement* arg0,
-                                              gpointer user_data);
-
-static void splitmuxsink_sink_added_callback(GstElement * object,
-                                             GstElement * arg0,
-                                             gpointer user_data);
-
-
-
-
-
-int main()
+#define RECORD_FRAGMENT_MS                  1000
+#define RECORD_DEFAULT_CHANNEL              "cam0"
+#define RECORD_STATS_INTERVAL_SEC           10
+#define RECORD_SHUTDOWN_TIMEOUT_SEC         10
+#define RECORD_PRE_EVENT_KB                 (8*1024)
+
+/**
+ * every channel is a Recorder with its own pipeline, all of them live in one
+ * process under a ChannelManager. the channels come from a key file, one
+ * group per channel:
+ *
+ *   [cam0]
+ *   dir=/data/cam0
+ *   width=1920
+ *   height=1080
+ *   fps=30
+ *   fragmented=true
+ *   fragment-ms=1000
+ *   pre-event-sec=10
+ *   pre-event-kb=8192
+ *   audio=raw
+ *   audio-encoder=faac
+ *   async-write=true
+ *   direct-io=true
+ *   drop-cache=false
+ *   preallocate-mb=512
+ *
+ * SIGHUP reloads the file, new groups start recording, removed ones stop and
+ * changed ones restart with the new settings.
+ * without a file a single channel is recorded. the control side runs on one
+ * GMainLoop for every channel and only wakes up for bus messages, signals and
+ * the stats timer.
+ *
+ * channels with pre-event-sec only record on a trigger, starting that many
+ * seconds early. SIGUSR1 triggers every armed channel, SIGUSR2 arms them again.
+ *
+ * audio=aac-adts or aac-raw takes AAC the capture side already encoded and
+ * only parses it, no encoder runs for that channel. audio=raw encodes with
+ * audio-encoder, faac unless e.g. the cheaper avenc_aac or fdkaacenc is set.
+ * audio=alaw or mulaw takes 8 kHz G.711 and decodes it in front of that
+ * encoder, MP4 gets AAC either way.
+ *
+ * async-write hands the split files to a segmentsink: the streaming thread
+ * only copies, an I/O thread per channel writes large aligned chunks, with
+ * O_DIRECT (direct-io) or dropped from the page cache (drop-cache) so many
+ * write-once recordings do not churn the cache, and preallocate-mb reserves
+ * each split file's extent when it is opened. direct-io takes the media data
+ * past the cache with qtmux (fragmented=false) as well as mp4mux, the moov
+ * rewrites and file tails stay buffered. direct-io plus drop-cache leaves
+ * nothing of a recording in the cache.
+ *
+ * SIGTERM / SIGINT finalize every channel, the process exits once each
+ * current split file is closed, or after RECORD_SHUTDOWN_TIMEOUT_SEC.
+ * */
+
+static GMainLoop*     g_loop         = nullptr;
+static ChannelManager g_channels;
+
+// fragmented mp4 : moov up front, then moof/mdat fragments appended as they
+// complete. the file is never seeked back into and stays playable up to its
+// last fragment after a crash, at the cost of a slightly bigger file
+static gboolean    g_fragmented    = FALSE;
+static gint        g_fragment_ms   = RECORD_FRAGMENT_MS;
+static gchar*      g_config_file   = NULL;
+static gchar*      g_record_dir    = (gchar*)".";
+static gint        g_pre_event_sec = 0;
+static gint        g_pre_event_kb  = RECORD_PRE_EVENT_KB;
+static gchar*      g_audio         = (gchar*)"raw";
+static gchar*      g_audio_encoder = (gchar*)"faac";
+static gboolean    g_async_write   = FALSE;
+static gboolean    g_direct_io     = FALSE;
+static gboolean    g_drop_cache    = FALSE;
+static gint        g_preallocate_mb = 0;
+
+static GOptionEntry entries[] = {
+  {"config", 'c', 0, G_OPTION_ARG_STRING, &g_config_file,
+      "Key file with one [group] per channel, reloaded on SIGHUP", "FILE"},
+  {"dir", 'd', 0, G_OPTION_ARG_STRING, &g_record_dir,
+      "Directory of channels that do not set one (default: .)", "DIR"},
+  {"fragmented", 'F', 0, G_OPTION_ARG_NONE, &g_fragmented,
+      "Record fragmented MP4, written append only", NULL},
+  {"fragment-ms", 0, 0, G_OPTION_ARG_INT, &g_fragment_ms,
+      "Fragment duration in ms with --fragmented (default: 1000)", "MS"},
+  {"pre-event", 'e', 0, G_OPTION_ARG_INT, &g_pre_event_sec,
+      "Record on SIGUSR1 only, starting SEC seconds before it (default: 0, always record)", "SEC"},
+  {"pre-event-kb", 0, 0, G_OPTION_ARG_INT, &g_pre_event_kb,
+      "Memory bound of each pre-event buffer in KB (default: 8192)", "KB"},
+  {"audio", 'a', 0, G_OPTION_ARG_STRING, &g_audio,
+      "Audio pushed by the capture side: raw, aac-adts, aac-raw, alaw or mulaw (default: raw)", "FORMAT"},
+  {"audio-encoder", 0, 0, G_OPTION_ARG_STRING, &g_audio_encoder,
+      "AAC encoder element for raw and G.711 audio (default: faac)", "ELEMENT"},
+  {"async-write", 'w', 0, G_OPTION_ARG_NONE, &g_async_write,
+      "Write split files from an I/O thread instead of the streaming thread", NULL},
+  {"direct-io", 0, 0, G_OPTION_ARG_NONE, &g_direct_io,
+      "With --async-write, bypass the page cache with O_DIRECT", NULL},
+  {"drop-cache", 0, 0, G_OPTION_ARG_NONE, &g_drop_cache,
+      "With --async-write, drop written pages from the page cache", NULL},
+  {"preallocate-mb", 0, 0, G_OPTION_ARG_INT, &g_preallocate_mb,
+      "With --async-write, MB allocated up front per split file (default: 0)", "MB"},
+  {NULL}
+};
+
+static RecorderConfig default_channel_config(const char* _name)
 {
-    printf("gst record \n");
-    gst_init(NULL, NULL);
-    init_record_pipeline();
-
-    while(1);
-    return 0;
+    RecorderConfig config;
+
+    config.name            = _name;
+    config.dir             = g_record_dir;
+    config.width           = RECORD_VIDEO_WIDTH;
+    config.height          = RECORD_VIDEO_HEIGHT;
+    config.fps             = RECORD_VIDEO_FPS;
+    config.fragmented      = g_fragmented;
+    config.fragment_ms     = g_fragment_ms;
+    config.pre_event_sec   = g_pre_event_sec;
+    config.pre_event_bytes = g_pre_event_kb * 1024;
+    config.audio_encoder   = g_audio_encoder;
+    recorder_audio_parse(g_audio, &config.audio);
+    config.async_write     = g_async_write;
+    config.direct_io       = g_direct_io;
+    config.drop_cache      = g_drop_cache;
+    config.preallocate_mb  = g_preallocate_mb;
+    return config;
 }
 
-int init_record_pipeline()
+static gint key_file_get_int(GKeyFile* _key_file, const gchar* _group, const gchar* _key, gint _default)
 {
-     ///////////////////////////////////////////////////////////////////////////
-    // Create elements
-    ////////////////////////////////////////////////////////////////////////////
-
-    auto record_elements_unref_fn = []() {
-        GST_OBJECT_UNREF(g_pipeline    );
-        GST_OBJECT_UNREF(g_video_src   );
-        GST_OBJECT_UNREF(g_audio_src   );
-        GST_OBJECT_UNREF(g_h264_parse  );
-        GST_OBJECT_UNREF(g_faac        );
-        GST_OBJECT_UNREF(g_aac_parse   );
-        GST_OBJECT_UNREF(g_qtmux       );
-        GST_OBJECT_UNREF(g_splitmuxsink);
-    };
-
-    g_pipeline      = gst_pipeline_new("dvr_pipeline");
-    g_video_src     = gst_element_factory_make("appsrc"      , "record_video_src" );
-    g_audio_src     = gst_element_factory_make("appsrc"      , "record_audio_src" );
-    g_h264_parse    = gst_element_factory_make("h264parse"   , "record_h264_parse");
-    g_faac          = gst_element_factory_make("faac"        , "record_faac"      );
-    g_aac_parse     = gst_element_factory_make("aacparse"    , "record_aac_parse" );
-    g_qtmux         = gst_element_factory_make("qtmux"       , "record_mux"       );
-    g_splitmuxsink  = gst_element_factory_make("splitmuxsink", "record_sink"      );
-
-
-    if( !g_pipeline || !g_video_src || !g_audio_src   || !g_h264_parse ||
-        !g_faac     || !g_aac_parse || !g_qtmux       || !g_splitmuxsink)
+    if (!g_key_file_has_key(_key_file, _group, _key, NULL))
     {
-        printf("[%s][not all element created,(%s)(%s)(%s)(%s)(%s)(%s)(%s)(%s)]\n", 
-            TAG,
-            !g_pipeline     ?"ng":"ok",
-            !g_video_src    ?"ng":"ok",
-            !g_audio_src    ?"ng":"ok",
-            !g_h264_parse   ?"ng":"ok",
-            !g_faac         ?"ng":"ok",
-            !g_aac_parse    ?"ng":"ok",
-            !g_qtmux        ?"ng":"ok",
-            !g_splitmuxsink ?"ng":"ok");
-
-        record_elements_unref_fn();
-        return -1;
+        return _default;
     }
+    return g_key_file_get_integer(_key_file, _group, _key, NULL);
+}
 
-    ////////////////////////////////////////////////////////////////////////////
-    // set elements properties
-    ////////////////////////////////////////////////////////////////////////////
-
-    // record_audio_src  properties --------------------------------------------
-    
-    // how to set properties
-    g_object_set(G_OBJECT(g_audio_src)  , 
-                 "stream-type"          , GST_APP_STREAM_TYPE_STREAM, 
-                 "format"               , GST_FORMAT_TIME, 
-                 NULL);
-
-    g_object_set(G_OBJECT(g_audio_src), "min-percent", 0, NULL);
-
-    GstCaps *caps_audio_src 
-        = gst_caps_new_simple("audio/x-raw",
-                              "format"  , G_TYPE_STRING, "S16LE"              ,
-                              "layout"  , G_TYPE_STRING, "interleaved"        ,
-                              "rate"    , G_TYPE_INT   , RECORD_AUDIO_RATE    ,
-                              "channels", G_TYPE_INT   , RECORD_AUDIO_CHANNEL , 
-                              NULL);
-
-    g_object_set(G_OBJECT(g_audio_src), "caps", caps_audio_src, NULL);
-    gst_caps_unref(caps_audio_src);
-
-    // how to set callback
-    g_signal_connect(g_audio_src, 
-                     "need-data"  , G_CALLBACK(need_audio_data_callback  ), 
-                     NULL/*user data*/);
-    g_signal_connect(g_audio_src, 
-                     "enough-data", G_CALLBACK(enough_audio_data_callback), 
-                     NULL/*user data*/);
-
-
-
-    // record_video_src  properties --------------------------------------------
-    g_object_set(G_OBJECT(g_video_src)  , 
-                 "stream-type"          , GST_APP_STREAM_TYPE_STREAM, 
-                 "format"               , GST_FORMAT_TIME, 
-                 NULL);
-
-    g_object_set(G_OBJECT(g_video_src), "min-percent", 0, NULL);
-
-    
-
-    // I don't think it is necessary
-    GstCaps *caps_video_src 
-        = gst_caps_new_simple("video/x-h264",
-                              "format"   , G_TYPE_STRING     , "byte-stream"       ,
-                              "alignment", G_TYPE_STRING     , "au"                ,
-                              "width"    , G_TYPE_INT        , RECORD_VIDEO_WIDTH  ,
-                              "height"   , G_TYPE_INT        , RECORD_VIDEO_HEIGHT , 
-                              "framerate", GST_TYPE_FRACTION , RECORD_VIDEO_FPS    , 1,
-                              NULL);
-
-    g_object_set(G_OBJECT(g_video_src), "caps", caps_video_src, NULL);
-    gst_caps_unref(caps_video_src);
-
-    g_signal_connect(g_video_src, 
-                     "need-data"  , G_CALLBACK(need_video_data_callback  ), 
-                     NULL/*user data*/);
-    g_signal_connect(g_video_src, 
-                     "enough-data", G_CALLBACK(enough_video_data_callback), 
-                     NULL/*user data*/);
-
-    // record_h264_parse  properties -------------------------------------------
-
-    // 如果h264流数据中IDR中没有SPS\PPS串，这里需要设置成-1，在feed时填充
-    // Send SPS and PPS Insertion Interval in seconds (sprop parameter sets will 
-    //be multiplexed in the data stream when detected.) 
-    //(0 = disabled, -1 = send with every IDR frame)
-    g_object_set(G_OBJECT(g_h264_parse), "config-interval", -1, NULL);
-
-    // qt_mux  properties ------------------------------------------------------
-    g_object_set(G_OBJECT(g_qtmux), 
-                 "reserved-max-duration"        , (guint64)(RECORD_MAX_NSEC), 
-                 NULL);
-    g_object_set(G_OBJECT(g_qtmux), 
-                 "reserved-bytes-per-sec"       , (guint32)(RECORD_BYTES_PER_SEC), 
-                 NULL);
-    g_object_set(G_OBJECT(g_qtmux), 
-                 "reserved-moov-update-period"  , (guint64)(RECORD_MOOV_UPDATE_PERIOD), 
-                 NULL);
-
-    // record sink  properties -------------------------------------------------
-    g_object_set(G_OBJECT(g_splitmuxsink), "muxer", g_qtmux, NULL);
-
-
-    g_object_set(G_OBJECT(g_splitmuxsink), 
-                 "max-size-time", (guint64)(RECORD_MAX_NSEC), 
-                 NULL);
-    g_signal_connect(g_splitmuxsink, 
-                     "format-location", G_CALLBACK(update_record_dest_callback), 
-                     NULL);
-    g_signal_connect(g_splitmuxsink, 
-                     "sink-added"     , G_CALLBACK(splitmuxsink_sink_added_callback), 
-                     NULL);
-    g_signal_connect(g_splitmuxsink, 
-                     "muxer-added"    , G_CALLBACK(splitmuxsink_muxer_added_callback), 
-                     NULL);                     
-    
-    ////////////////////////////////////////////////////////////////////////////
-    // link elements
-    //
-    // appsrc -> h264parse ---------->|
-    //                                |  -> splitmuxsink
-    // appsrc -> facc -> aacparse --->|
-    ////////////////////////////////////////////////////////////////////////////
-    gst_bin_add_many(GST_BIN(g_pipeline), 
-                    g_video_src, 
-                    g_h264_parse, 
-                    g_audio_src, 
-                    g_faac, 
-                    g_aac_parse,
-                    g_splitmuxsink,
-                    NULL);
-    // link appsrc -> h264parse -> splitmuxsink
-    if(!gst_element_link_many(g_video_src, g_h264_parse, NULL))
+static gboolean key_file_get_bool(GKeyFile* _key_file, const gchar* _group, const gchar* _key, gboolean _default)
+{
+    if (!g_key_file_has_key(_key_file, _group, _key, NULL))
     {
-        printf("[%s][link video src => h264 parse failed]\n", TAG);
-        record_elements_unref_fn();
-        return -1;
+        return _default;
     }
+    return g_key_file_get_boolean(_key_file, _group, _key, NULL);
+}
 
-    if(!gst_element_link_pads(g_h264_parse, "src", g_splitmuxsink, "video"))
+static bool load_channels(const char* _file, std::map<std::string, RecorderConfig>* _configs)
+{
+    GError* error = NULL;
+    GKeyFile* key_file = g_key_file_new();
+    gchar** groups;
+
+    if (!g_key_file_load_from_file(key_file, _file, G_KEY_FILE_NONE, &error))
     {
-        printf("[%s][link h264 parse => mux sink failed]\n", TAG);
-        GST_OBJECT_UNREF(g_pipeline    );
-        return -1;  
+        g_printerr("load channels %s failed: %s\n", _file, error->message);
+        g_clear_error(&error);
+        g_key_file_free(key_file);
+        return false;
     }
-    
-    // link appsrc -> faac -> aacparse -> splitmuxsink
-    GstCaps* caps_src2faac
-        = gst_caps_new_simple("audio/x-raw",
-                              "format"  , G_TYPE_STRING, "S16LE"              ,
-                              "layout"  , G_TYPE_STRING, "interleaved"        ,
-                              "rate"    , G_TYPE_INT   , RECORD_AUDIO_RATE    ,
-                              "channels", G_TYPE_INT   , RECORD_AUDIO_CHANNEL , 
-                              NULL);
-    if(!gst_element_link_filtered(g_audio_src, g_faac, caps_src2faac))
+
+    groups = g_key_file_get_groups(key_file, NULL);
+    for (gchar** group = groups; *group; group++)
     {
-        printf("[%s][link appsrc => faac failed]\n", TAG);
-        gst_caps_unref(caps_src2faac);
-        GST_OBJECT_UNREF(g_pipeline   );
-        return -1;  
+        RecorderConfig config = default_channel_config(*group);
+        gchar* dir = g_key_file_get_string(key_file, *group, "dir", NULL);
+
+        if (dir)
+        {
+            config.dir = dir;
+            g_free(dir);
+        }
+        config.width       = key_file_get_int(key_file, *group, "width" , config.width );
+        config.height      = key_file_get_int(key_file, *group, "height", config.height);
+        config.fps         = key_file_get_int(key_file, *group, "fps"   , config.fps   );
+        config.fragment_ms = key_file_get_int(key_file, *group, "fragment-ms", config.fragment_ms);
+        config.fragmented  = key_file_get_bool(key_file, *group, "fragmented", config.fragmented);
+        config.pre_event_sec   = key_file_get_int(key_file, *group, "pre-event-sec", config.pre_event_sec);
+        config.pre_event_bytes = key_file_get_int(key_file, *group, "pre-event-kb",
+                                                  config.pre_event_bytes / 1024) * 1024;
+        if (config.fragment_ms <= 0)
+        {
+            config.fragment_ms = RECORD_FRAGMENT_MS;
+        }
+
+        gchar* audio = g_key_file_get_string(key_file, *group, "audio", NULL);
+        if (audio && !recorder_audio_parse(audio, &config.audio))
+        {
+            g_printerr("channel %s: unknown audio %s, using raw\n", *group, audio);
+        }
+        g_free(audio);
+
+        gchar* encoder = g_key_file_get_string(key_file, *group, "audio-encoder", NULL);
+        if (encoder)
+        {
+            config.audio_encoder = encoder;
+            g_free(encoder);
+        }
+
+        config.async_write    = key_file_get_bool(key_file, *group, "async-write", config.async_write);
+        config.direct_io      = key_file_get_bool(key_file, *group, "direct-io"  , config.direct_io  );
+        config.drop_cache     = key_file_get_bool(key_file, *group, "drop-cache" , config.drop_cache );
+        config.preallocate_mb = key_file_get_int(key_file, *group, "preallocate-mb", config.preallocate_mb);
+
+        (*_configs)[config.name] = config;
     }
-    gst_caps_unref(caps_src2faac);
 
+    g_strfreev(groups);
+    g_key_file_free(key_file);
+    return true;
+}
 
+static gboolean reload_channels_callback(gpointer _udata)
+{
+    std::map<std::string, RecorderConfig> configs;
 
-    GstCaps* caps_faac2accparse
-        = gst_caps_new_simple("audio/mpeg",
-                              "mpegversion"     , G_TYPE_INT    , 4,
-                              "channels"        , G_TYPE_INT    , RECORD_AUDIO_CHANNEL,
-                              "rate"            , G_TYPE_INT    , RECORD_AUDIO_RATE,
-                              "stream-format"   , G_TYPE_STRING , "raw",
-                              "base-profile"    , G_TYPE_STRING , "lc",
-                              "framed"          , G_TYPE_BOOLEAN, TRUE, 
-                              NULL);
-    if(!gst_element_link_filtered(g_faac, g_aac_parse, caps_faac2accparse))
+    printf("[%s][reload %s]\n", TAG, g_config_file);
+    if (load_channels(g_config_file, &configs))
     {
-        printf("[%s][link faac => aac parse failed]\n", TAG);
-        gst_caps_unref(caps_faac2accparse);
-        GST_OBJECT_UNREF(g_pipeline        );
-        return -1;  
+        channel_manager_sync(&g_channels, configs);
     }
-    gst_caps_unref(caps_faac2accparse);
+    return G_SOURCE_CONTINUE;
+}
 
-    if(!gst_element_link_pads(g_aac_parse, "src", g_splitmuxsink, "audio_%u"))
-    {
-        GST_OBJECT_UNREF(g_pipeline        );
-        return -1;
-    }
+static void shutdown_done_callback(gpointer _udata)
+{
+    printf("[%s][all channels finalized]\n", TAG);
+    g_main_loop_quit(g_loop);
+}
 
-    
-    gst_element_set_state(g_pipeline, GST_STATE_PLAYING);
+static gboolean shutdown_timeout_callback(gpointer _udata)
+{
+    printf("[%s][shutdown timed out, files still open are cut]\n", TAG);
+    g_main_loop_quit(g_loop);
+    return G_SOURCE_REMOVE;
+}
 
-    GST_OBJECT_UNREF(g_pipeline    );
-    printf("end\n");
+static gboolean shutdown_callback(gpointer _udata)
+{
+    static bool shutting_down = false;
 
+    if (shutting_down)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+    shutting_down = true;
 
-    return 0;
+    printf("[%s][shutdown]\n", TAG);
+    g_timeout_add_seconds(RECORD_SHUTDOWN_TIMEOUT_SEC, shutdown_timeout_callback, NULL);
+    channel_manager_shutdown(&g_channels, shutdown_done_callback, NULL);
+    return G_SOURCE_CONTINUE;
 }
 
-int need_audio_data_callback()
+static void trigger_fn(Recorder* _recorder, gpointer _udata)
 {
-    printf("need_audio_data_callback \n");
-    return 0;
+    recorder_trigger(_recorder);
 }
 
-int enough_audio_data_callback()
+static void arm_fn(Recorder* _recorder, gpointer _udata)
 {
-    printf("enough_audio_data_callback \n");
-    return 0;
+    recorder_arm(_recorder);
 }
 
-int need_video_data_callback()
+static gboolean trigger_callback(gpointer _udata)
 {
-    printf("need_video_data_callback \n");
-    return 0;
+    channel_manager_foreach(&g_channels, trigger_fn, NULL);
+    return G_SOURCE_CONTINUE;
 }
 
-int enough_video_data_callback()
+static gboolean arm_callback(gpointer _udata)
 {
-    printf("enough_video_data_callback \n");
-    return 0;
+    channel_manager_foreach(&g_channels, arm_fn, NULL);
+    return G_SOURCE_CONTINUE;
 }
 
-gchar* update_record_dest_callback(GstElement* object, guint arg0, gpointer user_data)
+static gboolean print_stats_callback(gpointer _udata)
 {
-    printf("update_record_dest_callback \n");
-    return NULL;  
+    channel_manager_print_stats(&g_channels);
+    return G_SOURCE_CONTINUE;
 }
 
-void splitmuxsink_muxer_added_callback(GstElement* object,
-                                       GstElement* arg0,
-                                       gpointer user_data)
-{
-    printf("splitmuxsink_muxer_added_callback object:%s ele:%s \n",
-        GST_ELEMENT_NAME(object), GST_ELEMENT_NAME(arg0));
-}
 
-void splitmuxsink_sink_added_callback(GstElement * object,
-                                      GstElement * arg0,
-                                      gpointer user_data)
+int main(int argc, char* argv[])
 {
-    printf("splitmuxsink_sink_added_callback object:%s ele:%s \n",
-        GST_ELEMENT_NAME(object), GST_ELEMENT_NAME(arg0));
-}
\ No newline at end of file
+    GOptionContext* optctx;
+    GError*         error = NULL;
+    std::map<std::string, RecorderConfig> configs;
+
+    printf("gst record \n");
+
+    optctx = g_option_context_new("- record appsrc video/audio channels into split mp4 files");
+    g_option_context_add_main_entries(optctx, entries, NULL);
+    g_option_context_add_group(optctx, gst_init_get_option_group());
+    if (!g_option_context_parse(optctx, &argc, &argv, &error)) {
+        g_printerr("Error parsing options: %s\n", error->message);
+        g_option_context_free(optctx);
+        g_clear_error(&error);
+        return -1;
+    }
+    g_option_context_free(optctx);
+
+    RecorderAudio audio;
+    if (!recorder_audio_parse(g_audio, &audio))
+    {
+        g_printerr("Unknown audio format %s, expected raw, aac-adts, aac-raw, alaw or mulaw\n", g_audio);
+        return -1;
+    }
+
+    if (g_fragmented && g_fragment_ms <= 0)
+    {
+        g_fragment_ms = RECORD_FRAGMENT_MS;
+    }
+
+    if (g_config_file)
+    {
+        if (!load_channels(g_config_file, &configs))
+        {
+            return -1;
+        }
+        g_unix_signal_add(SIGHUP, reload_channels_callback, NULL);
+    }
+    else
+    {
+        configs[RECORD_DEFAULT_CHANNEL] = default_channel_config(RECORD_DEFAULT_CHANNEL);
+    }
+
+    g_loop = g_main_loop_new(NULL, FALSE);
+
+    g_unix_signal_add(SIGTERM, shutdown_callback, NULL);
+    g_unix_signal_add(SIGINT , shutdown_callback, NULL);
+    g_unix_signal_add(SIGUSR1, trigger_callback , NULL);
+    g_unix_signal_add(SIGUSR2, arm_callback     , NULL);
+
+    channel_manager_sync(&g_channels, configs);
+
+    g_timeout_add_seconds(RECORD_STATS_INTERVAL_SEC, print_stats_callback, NULL);
+
+    g_main_loop_run(g_loop);
+
+    /* after a timeout, whatever did not finish is stopped here */
+    {
+        std::lock_guard<std::mutex> guard(g_channels.lock);
+        g_channels.channels.clear();
+        g_channels.closing.clear();
+    }
+
+    g_main_loop_unref(g_loop);
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "record_feed.h"
+
+#include <cstdio>
+#include <gst/app/gstappsrc.h>
+
+#define RECORD_FEED_KEY "record-feed"
+
+static void record_feed_free(gpointer _udata)
+{
+    RecordFeed* feed   = (RecordFeed*)_udata;
+    GstBuffer*  buffer = nullptr;
+
+    {
+        std::lock_guard<std::mutex> guard(feed->lock);
+        feed->stopping = true;
+    }
+    feed->cond.notify_one();
+    feed->thread.join();
+
+    while (feed->queue.pop(&buffer))
+    {
+        gst_buffer_unref(buffer);
+    }
+    delete feed;
+}
+
+/**
+ * push queued buffers while the appsrc wants them. the drain thread and a
+ * holder both consume, whoever takes draining is the consumer. the flag is
+ * released with an exchange, so a push that found it taken is seen by the
+ * recheck.
+ * */
+static void record_feed_drain(RecordFeed* feed)
+{
+    GstBuffer* buffer = nullptr;
+
+    while (feed->need && !feed->queue.empty())
+    {
+        if (feed->draining.exchange(true, std::memory_order_acq_rel))
+        {
+            return;
+        }
+
+        /* enough-data is emitted from inside the push, need drops with it */
+        while (feed->need && feed->queue.pop(&buffer))
+        {
+            gst_app_src_push_buffer(GST_APP_SRC(feed->appsrc), buffer);
+        }
+
+        feed->draining.exchange(false, std::memory_order_acq_rel);
+    }
+}
+
+/**
+ * idle is published before the queue is looked at and the producer looks at
+ * idle after its push, the fences on both sides order the two. either this
+ * side sees the new frame, or the producer sees idle and notifies under the
+ * lock, after the wait has begun.
+ * */
+static void record_feed_run(RecordFeed* feed)
+{
+    std::unique_lock<std::mutex> guard(feed->lock);
+
+    for (;;)
+    {
+        feed->idle = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        feed->cond.wait(guard, [feed]() {
+            return feed->stopping || (feed->need && !feed->held && !feed->queue.empty());
+        });
+        feed->idle = false;
+        if (feed->stopping)
+        {
+            break;
+        }
+
+        guard.unlock();
+        record_feed_drain(feed);
+        guard.lock();
+    }
+}
+
+static void record_feed_wake(RecordFeed* feed)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (feed->idle)
+    {
+        std::lock_guard<std::mutex> guard(feed->lock);
+        feed->wakeups++;
+        feed->cond.notify_one();
+    }
+}
+
+RecordFeed* record_feed_attach(GstElement* appsrc, size_t depth)
+{
+    RecordFeed* feed = new RecordFeed(depth);
+
+    feed->appsrc = appsrc;
+    feed->pool   = appsrc_pool_get(appsrc);
+    feed->thread = std::thread(record_feed_run, feed);
+
+    g_object_set_data_full(G_OBJECT(appsrc), RECORD_FEED_KEY, feed, record_feed_free);
+    return feed;
+}
+
+void record_feed_need(RecordFeed* feed)
+{
+    feed->need = true;
+    record_feed_wake(feed);
+}
+
+void record_feed_enough(RecordFeed* feed)
+{
+    feed->need = false;
+}
+
+static GstBuffer* record_feed_buffer(RecordFeed* feed, const void* data, gsize size,
+                                     GstClockTime pts, bool key)
+{
+    GstBuffer* buffer = appsrc_pool_acquire(feed->pool, size);
+
+    gst_buffer_fill(buffer, 0, data, size);
+    GST_BUFFER_PTS(buffer) = pts;
+    if (!key)
+    {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    return buffer;
+}
+
+bool record_feed_push(RecordFeed* feed, const void* data, gsize size,
+                      GstClockTime pts, bool key)
+{
+    GstBuffer* buffer = nullptr;
+    guint64    depth  = 0;
+
+    if (feed->waiting_key && !key)
+    {
+        feed->dropped++;
+        return false;
+    }
+
+    /* checked before the copy, a full queue costs nothing */
+    if (feed->queue.full())
+    {
+        feed->dropped++;
+        feed->waiting_key = true;
+        return false;
+    }
+
+    buffer = record_feed_buffer(feed, data, size, pts, key);
+
+    /* the producer is alone on the tail, the queue can only have shrunk */
+    feed->queue.push(buffer);
+    feed->waiting_key = false;
+    feed->pushed++;
+
+    depth = feed->queue.size();
+    if (depth > feed->peak_depth)
+    {
+        feed->peak_depth = depth;
+    }
+
+    record_feed_wake(feed);
+    return true;
+}
+
+void record_feed_hold(RecordFeed* feed)
+{
+    GstBuffer* queued = nullptr;
+
+    /* the drain thread is out after its current pass, and stays asleep */
+    feed->held = true;
+    while (feed->draining.exchange(true, std::memory_order_acq_rel))
+    {
+        std::this_thread::yield();
+    }
+    while (feed->queue.pop(&queued))
+    {
+        gst_app_src_push_buffer(GST_APP_SRC(feed->appsrc), queued);
+    }
+}
+
+void record_feed_release(RecordFeed* feed)
+{
+    feed->draining.exchange(false, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> guard(feed->lock);
+        feed->held = false;
+    }
+    feed->cond.notify_one();
+}
+
+void record_feed_replay(RecordFeed* feed, const void* data, gsize size,
+                        GstClockTime pts, bool key)
+{
+    /* the appsrc takes it over max-bytes, it only emits enough-data */
+    gst_app_src_push_buffer(GST_APP_SRC(feed->appsrc), record_feed_buffer(feed, data, size, pts, key));
+    feed->pushed++;
+}
+
+void record_feed_end(RecordFeed* feed)
+{
+    record_feed_hold(feed);
+    gst_app_src_end_of_stream(GST_APP_SRC(feed->appsrc));
+    record_feed_release(feed);
+}
+
+void record_feed_print_stats(const char* name, RecordFeed* feed)
+{
+    if (!feed)
+    {
+        return;
+    }
+
+    printf("[record_feed][%s depth:%u/%u peak:%llu pushed:%llu dropped:%llu wakeups:%llu]\n", name,
+        (unsigned)feed->queue.size(), (unsigned)feed->queue.capacity(),
+        (unsigned long long)feed->peak_depth.exchange(0),
+        (unsigned long long)feed->pushed, (unsigned long long)feed->dropped,
+        (unsigned long long)feed->wakeups);
+}
@@ -0,0 +1,90 @@
+#ifndef RECORD_FEED_H
+#define RECORD_FEED_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <gst/gst.h>
+
+#include "appsrc_pool.h"
+#include "spsc_queue.h"
+
+/**
+ * feed path of a record appsrc : a capture thread copies each encoded video
+ * AU, or block of raw audio, into a pool buffer and pushes it into a bounded
+ * single producer / single consumer queue. a drain thread per feed moves
+ * the queue into the appsrc while the appsrc wants data.
+ *
+ * the capture thread never waits and never touches the appsrc. with the
+ * queue full the frame is dropped and counted, a video feed then drops up to
+ * the next keyframe so the recording does not continue from a broken
+ * reference. the drain thread sleeps from enough-data to the next need-data
+ * and on an empty queue, the producer only takes the feed lock to wake it.
+ * */
+struct RecordFeed
+{
+    explicit RecordFeed(size_t depth) : queue(depth) {}
+
+    GstElement*             appsrc      = nullptr;
+    AppsrcPool*             pool        = nullptr;
+    SpscQueue<GstBuffer*>   queue;
+    std::atomic<bool>       need        {false};    // between need-data and enough-data
+    std::atomic<bool>       draining    {false};    // the drain thread or a holder is the consumer
+    std::atomic<bool>       held        {false};    // record_feed_hold, the drain thread stays off
+    bool                    waiting_key = false;    // producer only
+
+    // drain thread
+    std::thread             thread;
+    std::mutex              lock;
+    std::condition_variable cond;
+    std::atomic<bool>       idle        {false};    // waiting on cond
+    bool                    stopping    = false;
+
+    std::atomic<guint64>    pushed      {0};
+    std::atomic<guint64>    dropped     {0};
+    std::atomic<guint64>    peak_depth  {0};
+    std::atomic<guint64>    wakeups     {0};
+};
+
+/**
+ * @brief create the feed of an appsrc and start its drain thread, both are
+ *        freed with the appsrc
+ * @param depth frames queued at most, attach the appsrc pool first
+ * */
+RecordFeed* record_feed_attach(GstElement* appsrc, size_t depth);
+
+/* need-data / enough-data of the appsrc */
+void record_feed_need(RecordFeed* feed);
+void record_feed_enough(RecordFeed* feed);
+
+/**
+ * @brief copy one frame into the queue, producer thread only
+ * @param key false for frames that depend on earlier ones
+ * @return false if the frame was dropped
+ * */
+bool record_feed_push(RecordFeed* feed, const void* data, gsize size,
+                      GstClockTime pts, bool key);
+
+/**
+ * @brief become the consumer in place of the drain thread, whatever is
+ *        queued goes into the appsrc first. the producer keeps queueing,
+ *        the queue is only drained again after record_feed_release
+ * */
+void record_feed_hold(RecordFeed* feed);
+void record_feed_release(RecordFeed* feed);
+
+/**
+ * @brief copy one frame straight into the appsrc, past the queue and the
+ *        appsrc's own limit. for a burst the queue could not hold, e.g. the
+ *        pre-event replay, with the feed held so live frames queue behind it
+ * */
+void record_feed_replay(RecordFeed* feed, const void* data, gsize size,
+                        GstClockTime pts, bool key);
+
+/* EOS into the appsrc behind everything queued, splitmuxsink closes the file */
+void record_feed_end(RecordFeed* feed);
+
+void record_feed_print_stats(const char* name, RecordFeed* feed);
+
+#endif // RECORD_FEED_H
@@ -0,0 +1,888 @@
+#include "recorder.h"
+
+#include <cstdio>
+#include <gst/app/gstappsrc.h>
+
+#include "appsrc_pool.h"
+#include "segment_sink.h"
+
+
+#define TAG "gst_record"
+
+#define GST_OBJECT_UNREF(element) \
+    if(element) {\
+        gst_object_unref(GST_OBJECT (element)); \
+    }
+
+
+#define RECORD_AUDIO_RATE                   48000
+#define RECORD_G711_RATE                    8000
+#define RECORD_AUDIO_CHANNEL                1
+#define RECORD_MAX_NSEC                     300*1000*1000*1000ULL
+#define RECORD_BYTES_PER_SEC                500
+#define RECORD_MOOV_UPDATE_PERIOD           1*1000*1000*1000
+
+// appsrc buffer pools, start at an estimate of the peak frame of each stream
+// and grow to the observed one. a video IDR is guessed at w*h/8 bytes
+#define RECORD_VIDEO_PEAK_FRAME_MIN         (64*1024)
+#define RECORD_VIDEO_POOL_MIN               8
+#define RECORD_VIDEO_POOL_MAX               32
+#define RECORD_AUDIO_FRAME_SAMPLES          1024
+#define RECORD_AUDIO_PEAK_FRAME_SIZE        (RECORD_AUDIO_FRAME_SAMPLES*RECORD_AUDIO_CHANNEL*2)
+#define RECORD_AUDIO_POOL_MIN               8
+#define RECORD_AUDIO_POOL_MAX               64
+
+// frames queued between a capture thread and its appsrc before dropping
+#define RECORD_VIDEO_QUEUE_DEPTH            64
+#define RECORD_AUDIO_QUEUE_DEPTH            128
+
+// a failed pipeline is restarted after this pause
+#define RECORD_RESTART_SEC                  5
+
+
+static void need_data_callback(GstElement* object,
+                               guint       length,
+                               gpointer    user_data);
+static void enough_data_callback(GstElement* object,
+                                 gpointer    user_data);
+
+static gchar* update_record_dest_callback(GstElement* object,
+                                          guint       arg0,
+                                          gpointer    user_data);
+
+static void splitmuxsink_muxer_added_callback(GstElement* object,
+                                              GstElement* arg0,
+                                              gpointer user_data);
+
+static void splitmuxsink_sink_added_callback(GstElement * object,
+                                             GstElement * arg0,
+                                             gpointer user_data);
+
+
+static gboolean recorder_bus_callback(GstBus*     bus,
+                                      GstMessage* message,
+                                      gpointer    user_data);
+
+static bool recorder_start_event(Recorder* recorder);
+
+
+bool recorder_config_equal(const RecorderConfig& a, const RecorderConfig& b)
+{
+    return a.name            == b.name            &&
+           a.dir             == b.dir             &&
+           a.width           == b.width           &&
+           a.height          == b.height          &&
+           a.fps             == b.fps             &&
+           a.fragmented      == b.fragmented      &&
+           a.fragment_ms     == b.fragment_ms     &&
+           a.pre_event_sec   == b.pre_event_sec   &&
+           a.pre_event_bytes == b.pre_event_bytes &&
+           a.audio           == b.audio           &&
+           a.audio_encoder   == b.audio_encoder   &&
+           a.async_write     == b.async_write     &&
+           a.direct_io       == b.direct_io       &&
+           a.drop_cache      == b.drop_cache      &&
+           a.preallocate_mb  == b.preallocate_mb;
+}
+
+bool recorder_audio_parse(const char* name, RecorderAudio* audio)
+{
+    if (g_strcmp0(name, "raw") == 0)
+    {
+        *audio = RECORDER_AUDIO_RAW;
+    }
+    else if (g_strcmp0(name, "aac-adts") == 0)
+    {
+        *audio = RECORDER_AUDIO_AAC_ADTS;
+    }
+    else if (g_strcmp0(name, "aac-raw") == 0)
+    {
+        *audio = RECORDER_AUDIO_AAC_RAW;
+    }
+    else if (g_strcmp0(name, "alaw") == 0)
+    {
+        *audio = RECORDER_AUDIO_ALAW;
+    }
+    else if (g_strcmp0(name, "mulaw") == 0)
+    {
+        *audio = RECORDER_AUDIO_MULAW;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/* AudioSpecificConfig of AAC-LC, bare frames carry no header to take it from */
+static GstBuffer* aac_codec_data(gint rate, gint channels)
+{
+    static const gint rates[] = { 96000, 88200, 64000, 48000, 44100, 32000,
+                                  24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+    guint8 index = 0;
+
+    while (index < G_N_ELEMENTS(rates) - 1 && rates[index] != rate)
+    {
+        index++;
+    }
+
+    guint8 config[2] = {
+        (guint8)((2 << 3) | (index >> 1)),                      // object type 2 : LC
+        (guint8)(((index & 1) << 7) | ((channels & 0x0f) << 3)),
+    };
+    GstBuffer* buffer = gst_buffer_new_allocate(NULL, sizeof(config), NULL);
+    gst_buffer_fill(buffer, 0, config, sizeof(config));
+    return buffer;
+}
+
+static bool recorder_audio_g711(RecorderAudio audio)
+{
+    return audio == RECORDER_AUDIO_ALAW || audio == RECORDER_AUDIO_MULAW;
+}
+
+static gint recorder_audio_rate(RecorderAudio audio)
+{
+    return recorder_audio_g711(audio) ? RECORD_G711_RATE : RECORD_AUDIO_RATE;
+}
+
+static GstCaps* recorder_raw_caps(gint rate)
+{
+    return gst_caps_new_simple("audio/x-raw",
+                               "format"  , G_TYPE_STRING, "S16LE"              ,
+                               "layout"  , G_TYPE_STRING, "interleaved"        ,
+                               "rate"    , G_TYPE_INT   , rate                 ,
+                               "channels", G_TYPE_INT   , RECORD_AUDIO_CHANNEL ,
+                               NULL);
+}
+
+/* caps the capture side pushes into the audio appsrc */
+static GstCaps* recorder_audio_caps(RecorderAudio audio)
+{
+    if (audio == RECORDER_AUDIO_RAW)
+    {
+        return recorder_raw_caps(RECORD_AUDIO_RATE);
+    }
+    if (recorder_audio_g711(audio))
+    {
+        return gst_caps_new_simple(audio == RECORDER_AUDIO_ALAW ? "audio/x-alaw" : "audio/x-mulaw",
+                                   "rate"    , G_TYPE_INT   , RECORD_G711_RATE     ,
+                                   "channels", G_TYPE_INT   , RECORD_AUDIO_CHANNEL ,
+                                   NULL);
+    }
+
+    GstCaps* caps
+        = gst_caps_new_simple("audio/mpeg",
+                              "mpegversion"     , G_TYPE_INT    , 4,
+                              "channels"        , G_TYPE_INT    , RECORD_AUDIO_CHANNEL,
+                              "rate"            , G_TYPE_INT    , RECORD_AUDIO_RATE,
+                              "stream-format"   , G_TYPE_STRING ,
+                                  audio == RECORDER_AUDIO_AAC_ADTS ? "adts" : "raw",
+                              "framed"          , G_TYPE_BOOLEAN, TRUE,
+                              NULL);
+    if (audio == RECORDER_AUDIO_AAC_RAW)
+    {
+        GstBuffer* codec_data = aac_codec_data(RECORD_AUDIO_RATE, RECORD_AUDIO_CHANNEL);
+        gst_caps_set_simple(caps, "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
+        gst_buffer_unref(codec_data);
+    }
+    return caps;
+}
+
+static void recorder_destroy(Recorder* recorder)
+{
+    if (recorder->bus_watch)
+    {
+        g_source_remove(recorder->bus_watch);
+    }
+    if (recorder->restart_timer)
+    {
+        g_source_remove(recorder->restart_timer);
+    }
+    if (recorder->pipeline)
+    {
+        gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+        gst_object_unref(recorder->pipeline);
+        printf("[%s][%s stopped]\n", TAG, recorder->config.name.c_str());
+    }
+    delete recorder->pre_event;
+    delete recorder;
+}
+
+/* one past the highest <name>_<n>.mp4 already in dir, 0 if there is none */
+static guint recorder_first_fragment(const RecorderConfig& config)
+{
+    GDir*        dir    = g_dir_open(config.dir.c_str(), 0, NULL);
+    std::string  prefix = config.name + "_";
+    const gchar* file;
+    guint        next   = 0;
+
+    while (dir && (file = g_dir_read_name(dir)))
+    {
+        gchar* end = NULL;
+
+        if (!g_str_has_prefix(file, prefix.c_str()) || !g_ascii_isdigit(file[prefix.size()]))
+        {
+            continue;
+        }
+        guint64 index = g_ascii_strtoull(file + prefix.size(), &end, 10);
+        if (g_strcmp0(end, ".mp4") == 0 && index < G_MAXINT)
+        {
+            next = MAX(next, (guint)index + 1);
+        }
+    }
+    if (dir)
+    {
+        g_dir_close(dir);
+    }
+    return next;
+}
+
+static bool recorder_build(Recorder* r)
+{
+    const RecorderConfig& config = r->config;
+
+     ///////////////////////////////////////////////////////////////////////////
+    // Create elements
+    ////////////////////////////////////////////////////////////////////////////
+
+    // until they are added to the pipeline every element is ours
+    auto record_elements_unref_fn = [r]() {
+        GST_OBJECT_UNREF(r->pipeline    );
+        GST_OBJECT_UNREF(r->video_src   );
+        GST_OBJECT_UNREF(r->audio_src   );
+        GST_OBJECT_UNREF(r->h264_parse  );
+        GST_OBJECT_UNREF(r->audio_dec   );
+        GST_OBJECT_UNREF(r->audio_enc   );
+        GST_OBJECT_UNREF(r->aac_parse   );
+        GST_OBJECT_UNREF(r->mux         );
+        GST_OBJECT_UNREF(r->splitmuxsink);
+        GST_OBJECT_UNREF(r->file_sink   );
+        r->pipeline = nullptr;
+    };
+
+    gchar* pipeline_name = g_strdup_printf("dvr_%s", config.name.c_str());
+    r->pipeline      = gst_pipeline_new(pipeline_name);
+    g_free(pipeline_name);
+    r->video_src     = gst_element_factory_make("appsrc"      , "record_video_src" );
+    r->audio_src     = gst_element_factory_make("appsrc"      , "record_audio_src" );
+    r->h264_parse    = gst_element_factory_make("h264parse"   , "record_h264_parse");
+    r->aac_parse     = gst_element_factory_make("aacparse"    , "record_aac_parse" );
+    r->mux           = gst_element_factory_make(config.fragmented ? "mp4mux" : "qtmux",
+                                                                    "record_mux"       );
+    r->splitmuxsink  = gst_element_factory_make("splitmuxsink", "record_sink"      );
+    if (recorder_audio_g711(config.audio))
+    {
+        r->audio_dec = gst_element_factory_make(config.audio == RECORDER_AUDIO_ALAW ? "alawdec" : "mulawdec",
+                                                "record_audio_dec");
+    }
+    if (config.audio == RECORDER_AUDIO_RAW || recorder_audio_g711(config.audio))
+    {
+        r->audio_enc = gst_element_factory_make(config.audio_encoder.c_str(), "record_audio_enc");
+    }
+    if (config.async_write)
+    {
+        SegmentWriterConfig writer_config;
+
+        writer_config.direct      = config.direct_io;
+        writer_config.drop_cache  = config.drop_cache;
+        writer_config.preallocate = (guint64)config.preallocate_mb * 1024 * 1024;
+        r->file_sink = segment_sink_new("record_file_sink", writer_config);
+    }
+
+
+    bool need_dec = recorder_audio_g711(config.audio);
+    bool need_enc = (config.audio == RECORDER_AUDIO_RAW) || need_dec;
+
+    if( !r->pipeline || !r->video_src || !r->audio_src   || !r->h264_parse ||
+        (need_dec && !r->audio_dec)   || (need_enc && !r->audio_enc)       ||
+        !r->aac_parse || !r->mux      || !r->splitmuxsink ||
+        (config.async_write && !r->file_sink))
+    {
+        printf("[%s][%s not all element created,(%s)(%s)(%s)(%s)(%s)(%s)(%s)(%s)(%s)(%s)]\n",
+            TAG, config.name.c_str(),
+            !r->pipeline     ?"ng":"ok",
+            !r->video_src    ?"ng":"ok",
+            !r->audio_src    ?"ng":"ok",
+            !r->h264_parse   ?"ng":"ok",
+            need_dec && !r->audio_dec ?"ng":"ok",
+            need_enc && !r->audio_enc ?"ng":"ok",
+            !r->aac_parse    ?"ng":"ok",
+            !r->mux          ?"ng":"ok",
+            !r->splitmuxsink ?"ng":"ok",
+            config.async_write && !r->file_sink ?"ng":"ok");
+
+        record_elements_unref_fn();
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // set elements properties
+    ////////////////////////////////////////////////////////////////////////////
+
+    // record_audio_src  properties --------------------------------------------
+
+    // how to set properties
+    g_object_set(G_OBJECT(r->audio_src)  ,
+                 "stream-type"          , GST_APP_STREAM_TYPE_STREAM,
+                 "format"               , GST_FORMAT_TIME,
+                 NULL);
+
+    g_object_set(G_OBJECT(r->audio_src), "min-percent", 0, NULL);
+
+    GstCaps *caps_audio_src = recorder_audio_caps(config.audio);
+
+    g_object_set(G_OBJECT(r->audio_src), "caps", caps_audio_src, NULL);
+    gst_caps_unref(caps_audio_src);
+
+    // buffers pushed into the appsrc are recycled through a pool
+    appsrc_pool_attach(r->audio_src, RECORD_AUDIO_PEAK_FRAME_SIZE,
+                       RECORD_AUDIO_POOL_MIN, RECORD_AUDIO_POOL_MAX);
+
+    // capture threads queue into the feed, its drain thread feeds the appsrc
+    r->audio_feed = record_feed_attach(r->audio_src, RECORD_AUDIO_QUEUE_DEPTH);
+
+    // how to set callback
+    g_signal_connect(r->audio_src,
+                     "need-data"  , G_CALLBACK(need_data_callback  ),
+                     r->audio_feed);
+    g_signal_connect(r->audio_src,
+                     "enough-data", G_CALLBACK(enough_data_callback),
+                     r->audio_feed);
+
+
+
+    // record_video_src  properties --------------------------------------------
+    g_object_set(G_OBJECT(r->video_src)  ,
+                 "stream-type"          , GST_APP_STREAM_TYPE_STREAM,
+                 "format"               , GST_FORMAT_TIME,
+                 NULL);
+
+    g_object_set(G_OBJECT(r->video_src), "min-percent", 0, NULL);
+
+
+
+    // I don't think it is necessary
+    GstCaps *caps_video_src
+        = gst_caps_new_simple("video/x-h264",
+                              "format"   , G_TYPE_STRING     , "byte-stream"       ,
+                              "alignment", G_TYPE_STRING     , "au"                ,
+                              "width"    , G_TYPE_INT        , config.width        ,
+                              "height"   , G_TYPE_INT        , config.height       ,
+                              "framerate", GST_TYPE_FRACTION , config.fps          , 1,
+                              NULL);
+
+    g_object_set(G_OBJECT(r->video_src), "caps", caps_video_src, NULL);
+    gst_caps_unref(caps_video_src);
+
+    guint video_peak = MAX((guint)(config.width * config.height / 8), (guint)RECORD_VIDEO_PEAK_FRAME_MIN);
+    appsrc_pool_attach(r->video_src, video_peak,
+                       RECORD_VIDEO_POOL_MIN, RECORD_VIDEO_POOL_MAX);
+
+    r->video_feed = record_feed_attach(r->video_src, RECORD_VIDEO_QUEUE_DEPTH);
+
+    g_signal_connect(r->video_src,
+                     "need-data"  , G_CALLBACK(need_data_callback  ),
+                     r->video_feed);
+    g_signal_connect(r->video_src,
+                     "enough-data", G_CALLBACK(enough_data_callback),
+                     r->video_feed);
+
+    // record_h264_parse  properties -------------------------------------------
+
+    // 如果h264流数据中IDR中没有SPS\PPS串，这里需要设置成-1，在feed时填充
+    // Send SPS and PPS Insertion Interval in seconds (sprop parameter sets will
+    //be multiplexed in the data stream when detected.)
+    //(0 = disabled, -1 = send with every IDR frame)
+    g_object_set(G_OBJECT(r->h264_parse), "config-interval", -1, NULL);
+
+    // qt_mux  properties ------------------------------------------------------
+    if (config.fragmented)
+    {
+        // streamable: no seek back to the moov once the file is done
+        g_object_set(G_OBJECT(r->mux),
+                     "fragment-duration"        , (guint)(config.fragment_ms),
+                     "streamable"               , TRUE,
+                     NULL);
+    }
+    else
+    {
+        // robust muxing: a moov reserved up front and rewritten periodically
+        g_object_set(G_OBJECT(r->mux),
+                     "reserved-max-duration"        , (guint64)(RECORD_MAX_NSEC),
+                     NULL);
+        g_object_set(G_OBJECT(r->mux),
+                     "reserved-bytes-per-sec"       , (guint32)(RECORD_BYTES_PER_SEC),
+                     NULL);
+        g_object_set(G_OBJECT(r->mux),
+                     "reserved-moov-update-period"  , (guint64)(RECORD_MOOV_UPDATE_PERIOD),
+                     NULL);
+    }
+
+    // record sink  properties -------------------------------------------------
+    g_object_set(G_OBJECT(r->splitmuxsink), "muxer", r->mux, NULL);
+
+    // sink-added fires once the sink is already in place, it is handed over here
+    if (r->file_sink)
+    {
+        g_object_set(G_OBJECT(r->splitmuxsink), "sink", r->file_sink, NULL);
+    }
+
+    r->next_fragment = recorder_first_fragment(config);
+
+    gchar* location = g_strdup_printf("%s/%s_%%05d.mp4", config.dir.c_str(), config.name.c_str());
+    g_object_set(G_OBJECT(r->splitmuxsink),
+                 "location"     , location,
+                 "max-size-time", (guint64)(RECORD_MAX_NSEC),
+                 "start-index"  , (gint)r->next_fragment,
+                 NULL);
+    g_free(location);
+    g_signal_connect(r->splitmuxsink,
+                     "format-location", G_CALLBACK(update_record_dest_callback),
+                     r);
+    g_signal_connect(r->splitmuxsink,
+                     "sink-added"     , G_CALLBACK(splitmuxsink_sink_added_callback),
+                     r);
+    g_signal_connect(r->splitmuxsink,
+                     "muxer-added"    , G_CALLBACK(splitmuxsink_muxer_added_callback),
+                     r);
+
+    ////////////////////////////////////////////////////////////////////////////
+    // link elements
+    //
+    // appsrc -> h264parse ---------->|
+    //                                |  -> splitmuxsink
+    // appsrc -> facc -> aacparse --->|
+    //
+    // appsrc ---------> aacparse --->|  (pre-encoded AAC)
+    //
+    // appsrc -> alawdec -> facc -> aacparse --->|  (G.711)
+    ////////////////////////////////////////////////////////////////////////////
+    gst_bin_add_many(GST_BIN(r->pipeline),
+                    r->video_src,
+                    r->h264_parse,
+                    r->audio_src,
+                    r->aac_parse,
+                    r->splitmuxsink,
+                    NULL);
+    if (r->audio_dec)
+    {
+        gst_bin_add(GST_BIN(r->pipeline), r->audio_dec);
+    }
+    if (r->audio_enc)
+    {
+        gst_bin_add(GST_BIN(r->pipeline), r->audio_enc);
+    }
+    // the muxer went into splitmuxsink with its property
+    auto pipeline_unref_fn = [r]() {
+        GST_OBJECT_UNREF(r->pipeline);
+        r->pipeline = nullptr;
+    };
+
+    // link appsrc -> h264parse -> splitmuxsink
+    if(!gst_element_link_many(r->video_src, r->h264_parse, NULL))
+    {
+        printf("[%s][link video src => h264 parse failed]\n", TAG);
+        pipeline_unref_fn();
+        return false;
+    }
+
+    if(!gst_element_link_pads(r->h264_parse, "src", r->splitmuxsink, "video"))
+    {
+        printf("[%s][link h264 parse => mux sink failed]\n", TAG);
+        pipeline_unref_fn();
+        return false;
+    }
+
+    if (!r->audio_enc)
+    {
+        // link appsrc -> aacparse -> splitmuxsink, the appsrc caps say which AAC
+        if(!gst_element_link(r->audio_src, r->aac_parse))
+        {
+            printf("[%s][link appsrc => aac parse failed]\n", TAG);
+            pipeline_unref_fn();
+            return false;
+        }
+    }
+    else
+    {
+        // link appsrc [-> G.711 decoder] -> encoder -> aacparse -> splitmuxsink
+        gint        rate      = recorder_audio_rate(config.audio);
+        GstElement* enc_input = r->audio_src;
+
+        if (r->audio_dec)
+        {
+            if(!gst_element_link(r->audio_src, r->audio_dec))
+            {
+                printf("[%s][link appsrc => G.711 decoder failed]\n", TAG);
+                pipeline_unref_fn();
+                return false;
+            }
+            enc_input = r->audio_dec;
+        }
+
+        GstCaps* caps_src2faac = recorder_raw_caps(rate);
+        if(!gst_element_link_filtered(enc_input, r->audio_enc, caps_src2faac))
+        {
+            printf("[%s][link appsrc => %s failed]\n", TAG, config.audio_encoder.c_str());
+            gst_caps_unref(caps_src2faac);
+            pipeline_unref_fn();
+            return false;
+        }
+        gst_caps_unref(caps_src2faac);
+
+        // any AAC encoder hands raw frames to aacparse
+        GstCaps* caps_faac2accparse
+            = gst_caps_new_simple("audio/mpeg",
+                                  "mpegversion"     , G_TYPE_INT    , 4,
+                                  "channels"        , G_TYPE_INT    , RECORD_AUDIO_CHANNEL,
+                                  "rate"            , G_TYPE_INT    , rate,
+                                  "stream-format"   , G_TYPE_STRING , "raw",
+                                  NULL);
+        if(!gst_element_link_filtered(r->audio_enc, r->aac_parse, caps_faac2accparse))
+        {
+            printf("[%s][link %s => aac parse failed]\n", TAG, config.audio_encoder.c_str());
+            gst_caps_unref(caps_faac2accparse);
+            pipeline_unref_fn();
+            return false;
+        }
+        gst_caps_unref(caps_faac2accparse);
+    }
+
+    if(!gst_element_link_pads(r->aac_parse, "src", r->splitmuxsink, "audio_%u"))
+    {
+        printf("[%s][link aac parse => mux sink failed]\n", TAG);
+        pipeline_unref_fn();
+        return false;
+    }
+
+    return true;
+}
+
+RecorderPtr recorder_create(const RecorderConfig& config)
+{
+    Recorder* recorder = new Recorder();
+    recorder->config = config;
+
+    if (!recorder_build(recorder))
+    {
+        delete recorder;
+        return nullptr;
+    }
+
+    if (config.pre_event_sec > 0)
+    {
+        recorder->pre_event = new PreEventRing((size_t)config.pre_event_bytes,
+            (GstClockTime)config.pre_event_sec * GST_SECOND,
+            recorder->video_feed, recorder->audio_feed);
+    }
+
+    GstBus* bus = gst_element_get_bus(recorder->pipeline);
+    recorder->bus_watch = gst_bus_add_watch(bus, recorder_bus_callback, recorder);
+    gst_object_unref(bus);
+
+    std::string audio = config.audio_encoder;
+    if (recorder_audio_g711(config.audio))
+    {
+        audio = (config.audio == RECORDER_AUDIO_ALAW ? "alaw -> " : "mulaw -> ") + audio;
+    }
+    else if (config.audio != RECORDER_AUDIO_RAW)
+    {
+        audio = "aac pass-through";
+    }
+
+    gst_element_set_state(recorder->pipeline, GST_STATE_PLAYING);
+    printf("[%s][%s %s to %s, %dx%d@%d%s, audio %s]\n", TAG, config.name.c_str(),
+        recorder->pre_event ? "armed" : "recording", config.dir.c_str(),
+        config.width, config.height, config.fps, config.fragmented ? " fragmented" : "",
+        audio.c_str());
+
+    return RecorderPtr(recorder, recorder_destroy);
+}
+
+/* EOS or an error while finalizing, the last file is as closed as it gets */
+static void recorder_finalized(Recorder* recorder)
+{
+    RecorderFinalizedFunc finalized = recorder->finalized;
+
+    gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+    recorder->finalized = nullptr;
+    if (finalized)
+    {
+        finalized(recorder, recorder->finalized_udata);
+    }
+}
+
+void recorder_finalize(Recorder* recorder, RecorderFinalizedFunc finalized, gpointer udata)
+{
+    recorder->finalizing      = true;
+    recorder->finalized       = finalized;
+    recorder->finalized_udata = udata;
+
+    if (recorder->restart_timer || recorder->stopped)
+    {
+        /* stopped by an error or between two events, there is no open file left */
+        if (recorder->restart_timer)
+        {
+            g_source_remove(recorder->restart_timer);
+            recorder->restart_timer = 0;
+        }
+        recorder_finalized(recorder);
+        return;
+    }
+
+    /* the EOS of the event file is on its way, it finalizes */
+    printf("[%s][%s finalizing]\n", TAG, recorder->config.name.c_str());
+    if (recorder->event_closing)
+    {
+        return;
+    }
+
+    /* EOS on every stream behind what is queued, splitmuxsink closes the
+     * file once both arrived */
+    record_feed_end(recorder->video_feed);
+    record_feed_end(recorder->audio_feed);
+}
+
+static gboolean recorder_restart_callback(gpointer user_data)
+{
+    Recorder* recorder = (Recorder*)user_data;
+    guint     index    = recorder->next_fragment;
+
+    /* READY -> PAUSED resets the file counter of splitmuxsink to start-index */
+    recorder->restart_timer = 0;
+    g_object_set(G_OBJECT(recorder->splitmuxsink), "start-index", (gint)index, NULL);
+    printf("[%s][%s restart at file %u]\n", TAG, recorder->config.name.c_str(), index);
+    gst_element_set_state(recorder->pipeline, GST_STATE_PLAYING);
+    return G_SOURCE_REMOVE;
+}
+
+/* stop the pipeline, a new split file once it comes back */
+static void recorder_schedule_restart(Recorder* recorder)
+{
+    if (recorder->restart_timer)
+    {
+        return;
+    }
+    gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+    recorder->restart_timer = g_timeout_add_seconds(RECORD_RESTART_SEC,
+        recorder_restart_callback, recorder);
+}
+
+gboolean recorder_bus_callback(GstBus* bus, GstMessage* message, gpointer user_data)
+{
+    Recorder*   recorder = (Recorder*)user_data;
+    const char* name     = recorder->config.name.c_str();
+
+    switch (GST_MESSAGE_TYPE(message))
+    {
+    case GST_MESSAGE_EOS:
+    {
+        if (recorder->finalizing)
+        {
+            printf("[%s][%s EOS]\n", TAG, name);
+            recorder_finalized(recorder);
+        }
+        else if (recorder->event_closing)
+        {
+            /* NULL takes the EOS out of the appsrcs for the next event */
+            printf("[%s][%s event file closed]\n", TAG, name);
+            gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+            recorder->event_closing = false;
+            recorder->stopped       = true;
+            if (recorder->trigger_pending)
+            {
+                recorder->trigger_pending = false;
+                recorder_start_event(recorder);
+            }
+        }
+        else
+        {
+            /* the file is closed, but the channel is meant to go on */
+            printf("[%s][%s unexpected EOS, restart in %ds]\n", TAG, name, RECORD_RESTART_SEC);
+            recorder_schedule_restart(recorder);
+        }
+        break;
+    }
+    case GST_MESSAGE_ERROR:
+    {
+        GError *err = NULL;
+        gchar *dbg_info = NULL;
+
+        gst_message_parse_error(message, &err, &dbg_info);
+        g_printerr("[%s][%s ERROR from element %s: %s]\n", TAG, name,
+            GST_OBJECT_NAME(message->src), err->message);
+        g_printerr("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
+        g_error_free(err);
+        g_free(dbg_info);
+
+        if (recorder->finalizing)
+        {
+            recorder_finalized(recorder);
+        }
+        else
+        {
+            recorder_schedule_restart(recorder);
+        }
+        break;
+    }
+    case GST_MESSAGE_STATE_CHANGED:
+    {
+        GstState old_state, new_state;
+
+        if (GST_MESSAGE_SRC(message) != GST_OBJECT(recorder->pipeline))
+        {
+            break;
+        }
+        gst_message_parse_state_changed(message, &old_state, &new_state, NULL);
+        printf("[%s][%s %s -> %s]\n", TAG, name,
+            gst_element_state_get_name(old_state),
+            gst_element_state_get_name(new_state));
+        break;
+    }
+    case GST_MESSAGE_ELEMENT:
+    {
+        const GstStructure* s = gst_message_get_structure(message);
+
+        if (s && gst_structure_has_name(s, "splitmuxsink-fragment-closed"))
+        {
+            printf("[%s][%s closed %s]\n", TAG, name,
+                gst_structure_get_string(s, "location"));
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return TRUE;
+}
+
+bool recorder_push_video(Recorder* recorder, const void* data, gsize size,
+                         GstClockTime pts, bool key)
+{
+    if (recorder->pre_event)
+    {
+        return pre_event_ring_push(recorder->pre_event, PRE_EVENT_VIDEO, data, size, pts, key);
+    }
+    return record_feed_push(recorder->video_feed, data, size, pts, key);
+}
+
+// every block of raw audio, or AAC frame, stands on its own
+bool recorder_push_audio(Recorder* recorder, const void* data, gsize size,
+                         GstClockTime pts)
+{
+    if (recorder->pre_event)
+    {
+        return pre_event_ring_push(recorder->pre_event, PRE_EVENT_AUDIO, data, size, pts, true);
+    }
+    return record_feed_push(recorder->audio_feed, data, size, pts, true);
+}
+
+/* replay the ring into a new split file, from NULL after the last event */
+static bool recorder_start_event(Recorder* recorder)
+{
+    if (recorder->stopped)
+    {
+        guint index = recorder->next_fragment;
+
+        g_object_set(G_OBJECT(recorder->splitmuxsink), "start-index", (gint)index, NULL);
+        gst_element_set_state(recorder->pipeline, GST_STATE_PLAYING);
+        recorder->stopped = false;
+    }
+    recorder->recorded = true;
+
+    printf("[%s][%s triggered]\n", TAG, recorder->config.name.c_str());
+    return pre_event_ring_trigger(recorder->pre_event);
+}
+
+bool recorder_trigger(Recorder* recorder)
+{
+    if (!recorder->pre_event || recorder->pre_event->live || recorder->finalizing)
+    {
+        return false;
+    }
+
+    /* the ring keeps filling until the last event file is closed */
+    if (recorder->event_closing)
+    {
+        printf("[%s][%s triggered, waiting for the last file to close]\n",
+            TAG, recorder->config.name.c_str());
+        recorder->trigger_pending = true;
+        return true;
+    }
+    return recorder_start_event(recorder);
+}
+
+void recorder_arm(Recorder* recorder)
+{
+    if (!recorder->pre_event)
+    {
+        return;
+    }
+
+    bool live = recorder->pre_event->live;
+
+    printf("[%s][%s armed]\n", TAG, recorder->config.name.c_str());
+    recorder->trigger_pending = false;
+    pre_event_ring_arm(recorder->pre_event);
+
+    /* frames go into the ring now, the event file is done */
+    if (live && recorder->recorded && !recorder->finalizing)
+    {
+        record_feed_end(recorder->video_feed);
+        record_feed_end(recorder->audio_feed);
+        recorder->recorded      = false;
+        recorder->event_closing = true;
+    }
+}
+
+void recorder_print_stats(Recorder* recorder)
+{
+    printf("[%s][%s]\n", TAG, recorder->config.name.c_str());
+    appsrc_pool_print_stats("video", appsrc_pool_get(recorder->video_src));
+    appsrc_pool_print_stats("audio", appsrc_pool_get(recorder->audio_src));
+    record_feed_print_stats("video", recorder->video_feed);
+    record_feed_print_stats("audio", recorder->audio_feed);
+    if (recorder->pre_event)
+    {
+        pre_event_ring_print_stats(recorder->config.name.c_str(), recorder->pre_event);
+    }
+    if (recorder->file_sink)
+    {
+        segment_sink_print_stats(recorder->config.name.c_str(), recorder->file_sink);
+    }
+}
+
+void need_data_callback(GstElement* object, guint length, gpointer user_data)
+{
+    record_feed_need((RecordFeed*)user_data);
+}
+
+void enough_data_callback(GstElement* object, gpointer user_data)
+{
+    record_feed_enough((RecordFeed*)user_data);
+}
+
+// only tracks the index, the file name stays the one from location
+gchar* update_record_dest_callback(GstElement* object, guint arg0, gpointer user_data)
+{
+    Recorder* recorder = (Recorder*)user_data;
+
+    recorder->next_fragment = arg0 + 1;
+    return NULL;
+}
+
+void splitmuxsink_muxer_added_callback(GstElement* object,
+                                       GstElement* arg0,
+                                       gpointer user_data)
+{
+    printf("splitmuxsink_muxer_added_callback object:%s ele:%s \n",
+        GST_ELEMENT_NAME(object), GST_ELEMENT_NAME(arg0));
+}
+
+void splitmuxsink_sink_added_callback(GstElement * object,
+                                      GstElement * arg0,
+                                      gpointer user_data)
+{
+    printf("splitmuxsink_sink_added_callback object:%s ele:%s \n",
+        GST_ELEMENT_NAME(object), GST_ELEMENT_NAME(arg0));
+}
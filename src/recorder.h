@@ -0,0 +1,145 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <gst/gst.h>
+
+#include "pre_event_ring.h"
+#include "record_feed.h"
+
+enum RecorderAudio
+{
+    RECORDER_AUDIO_RAW      = 0,    // S16LE, encoded to AAC in the pipeline
+    RECORDER_AUDIO_AAC_ADTS = 1,    // AAC already encoded, ADTS framed
+    RECORDER_AUDIO_AAC_RAW  = 2,    // AAC-LC already encoded, one bare frame per push
+    RECORDER_AUDIO_ALAW     = 3,    // G.711 A-law 8 kHz, decoded and encoded to AAC
+    RECORDER_AUDIO_MULAW    = 4,    // G.711 mu-law 8 kHz, decoded and encoded to AAC
+};
+
+struct RecorderConfig
+{
+    std::string name;                   // channel name, also the file prefix
+    std::string dir         = ".";      // split files are <dir>/<name>_%05d.mp4
+    gint        width       = 1920;
+    gint        height      = 1080;
+    gint        fps         = 30;
+    gboolean    fragmented  = FALSE;
+    gint        fragment_ms = 1000;
+    gint        pre_event_sec   = 0;            // > 0 : record on trigger only
+    gint        pre_event_bytes = 8*1024*1024;  // bound of the pre-event ring
+    RecorderAudio audio         = RECORDER_AUDIO_RAW;
+    std::string   audio_encoder = "faac";       // raw and G.711 audio
+    gboolean    async_write     = FALSE;        // split files written by a segmentsink
+    gboolean    direct_io       = FALSE;        // async_write : O_DIRECT
+    gboolean    drop_cache      = FALSE;        // async_write : fadvise DONTNEED
+    gint        preallocate_mb  = 0;            // async_write : fallocate per split file
+};
+
+struct Recorder;
+
+/* called on the main loop once the last split file of a recorder is closed */
+typedef void (*RecorderFinalizedFunc)(Recorder* recorder, gpointer udata);
+
+/**
+ * one recording channel : its own pipeline
+ *
+ *   appsrc -> h264parse ---------->|
+ *                                  |  -> splitmuxsink
+ *   appsrc -> faac -> aacparse --->|
+ *
+ * audio that comes in as AAC skips the encoder, appsrc -> aacparse, which
+ * takes the encode, the biggest per channel cost, out of the process. G.711
+ * is decoded in front of the encoder, appsrc -> alawdec|mulawdec -> faac,
+ * MP4 takes AAC here.
+ *
+ * fed by the capture threads of the channel through its two feeds. the
+ * elements belong to the pipeline, only the pipeline is referenced here.
+ *
+ * with pre_event_sec set the channel is armed instead of recording: frames
+ * go into a pre-event ring and a trigger replays it into a new split file,
+ * then records live until armed again. arming ends the file with EOS and
+ * stops the pipeline, the next trigger starts it again. a trigger that comes
+ * before that EOS waits for it.
+ *
+ * with async_write the split files go through a segmentsink instead of
+ * filesink, the writes leave the streaming thread for an I/O thread.
+ *
+ * its bus is watched from the default main context: a failed pipeline, or
+ * one that saw an EOS nobody asked for, is restarted into a new split file
+ * after a pause, finalizing sends EOS down both streams so splitmuxsink
+ * closes the current file properly. split files are numbered on from the
+ * highest one already in dir and across restarts, none is overwritten.
+ * */
+struct Recorder
+{
+    RecorderConfig config;
+
+    GstElement*    pipeline     = nullptr;
+    GstElement*    video_src    = nullptr;
+    GstElement*    audio_src    = nullptr;
+    GstElement*    h264_parse   = nullptr;
+    GstElement*    audio_dec    = nullptr;      // only for G.711
+    GstElement*    audio_enc    = nullptr;      // only for raw and G.711 audio
+    GstElement*    aac_parse    = nullptr;
+    GstElement*    mux          = nullptr;
+    GstElement*    splitmuxsink = nullptr;
+    GstElement*    file_sink    = nullptr;      // async_write only, owned by splitmuxsink
+
+    RecordFeed*    video_feed   = nullptr;
+    RecordFeed*    audio_feed   = nullptr;
+    PreEventRing*  pre_event    = nullptr;
+    bool           recorded     = false;        // a split file is open
+    bool           event_closing   = false;     // armed, waiting for the EOS of the event file
+    bool           trigger_pending = false;     // triggered while event_closing
+    bool           stopped         = false;     // in NULL between two events
+    std::atomic<guint> next_fragment {0};       // index of the next split file
+
+    guint                 bus_watch       = 0;
+    guint                 restart_timer   = 0;
+    bool                  finalizing      = false;
+    RecorderFinalizedFunc finalized       = nullptr;
+    gpointer              finalized_udata = nullptr;
+};
+
+typedef std::shared_ptr<Recorder> RecorderPtr;
+
+/* field by field, a channel whose config changed is built anew */
+bool recorder_config_equal(const RecorderConfig& a, const RecorderConfig& b);
+
+/* "raw", "aac-adts", "aac-raw", "alaw" or "mulaw", false for anything else */
+bool recorder_audio_parse(const char* name, RecorderAudio* audio);
+
+/**
+ * @brief build the channel's pipeline and start it
+ * @return nullptr if the pipeline could not be built, the recorder is
+ *         stopped and freed with its last reference
+ * */
+RecorderPtr recorder_create(const RecorderConfig& config);
+
+/**
+ * @brief end the recording, the current split file is closed with a proper
+ *        moov. finalized runs on the main loop once the pipeline stopped.
+ *        main loop only, it shares the restart timer with the bus watch
+ * */
+void recorder_finalize(Recorder* recorder, RecorderFinalizedFunc finalized, gpointer udata);
+
+/* feeding API for the capture threads, one thread per stream and channel.
+ * never blocks, false if the frame was dropped because the channel fell behind.
+ * audio is whatever config.audio says: S16LE blocks, ADTS frames, bare AAC frames
+ * or G.711 bytes */
+bool recorder_push_video(Recorder* recorder, const void* data, gsize size,
+                         GstClockTime pts, bool key);
+bool recorder_push_audio(Recorder* recorder, const void* data, gsize size,
+                         GstClockTime pts);
+
+/* start recording with the pre-event seconds in front, false if not armed */
+bool recorder_trigger(Recorder* recorder);
+
+/* stop recording and buffer the pre-event seconds again */
+void recorder_arm(Recorder* recorder);
+
+void recorder_print_stats(Recorder* recorder);
+
+#endif // RECORDER_H
@@ -19,6 +19,9 @@
 
 /**
  * ./rtsp_server2 "( appsrc name="myappsrc" ! rtph264pay name=pay0 pt=96 config-interval=1 )"
+ * ./rtsp_server2 -i record.264 "( appsrc name="myappsrc" ! rtph264pay name=pay0 pt=96 config-interval=1 )"
+ * ./rtsp_server2 -c /data/streams      (one mount per .264 file, rtsp://127.0.0.1:8554/<file name>)
+ * ./rtsp_server2 -s ...                (one pipeline per mount, later clients join at the next IDR)
  * 
  * rtsp_client can use
  * (1) gst-launch-1.0 rtspsrc location="rtsp://127.0.0.1:8554/test" ! rtph264depay ! appsink
@@ -34,318 +37,1327 @@ extern "C"
 #include <stdio.h>
 
 #include <gst/rtsp-server/rtsp-server.h>
-
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavformat/avio.h>
-#include <libavutil/file.h>
 }
 
 
-#include <list>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
-#define SPS_PPS_LEN     (4+22+4+4)
-uint32_t SPS_PPS_BUFFER[SPS_PPS_LEN] = {0};
+#include "frame_pool.h"
+#include "h264_index.h"
+#include "h264_nal.h"
+#include "rtsp_tcp_sender.h"
 
-int isH264Ifream(unsigned char *data)
+/**
+ * parameter sets in effect from some frame on, shared by every frame up to
+ * the next in-band change.
+ * */
+struct H264Params
 {
-    if (!data)
+    std::string annexb;             // every SPS/PPS known at that point
+    H264Sps     sps;                // the SPS that changed last
+    bool        has_sps = false;
+};
+
+using H264ParamsPtr = std::shared_ptr<const H264Params>;
+
+/**
+ * one access unit of a mapped file. buf/size point into the mapping and the
+ * frame holds a reference on it, so no copy is made and the data stays valid
+ * for buffers in flight after the source is closed.
+ * */
+struct H264Frame
+{
+    H264Frame(const uint8_t* _data, uint32_t _size, std::shared_ptr<void> _owner)
+        : owner(std::move(_owner))
     {
-        return 0;
+        buf  = (uint8_t*)_data;
+        size = _size;
     }
 
-    unsigned char nal_type = data[4] & 0x1f;   //H264的分隔符可能是    00 00 00 01 或者 00 00 01
+    H264Frame(const H264Frame&) = delete;
+    H264Frame& operator=(const H264Frame&) = delete;
+
+    std::shared_ptr<void> owner;    // the mapped file
+    uint8_t* buf     = nullptr;
+    uint32_t size    = 0;
+    bool     is_idr = false;
+    bool     has_param_sets = false;   // SPS and PPS are in-band
+    H264ParamsPtr params;              // parameter sets the frame decodes with
+
+    /* nanoseconds on the source timeline, dts may be negative with B frames */
+    int64_t  pts      = 0;
+    int64_t  dts      = 0;
+    int64_t  duration = 0;
+};
+
+using H264FramePtr = std::shared_ptr<H264Frame>;
+
+
+/**
+ * streaming ingest : the file is mapped and its frame index (see h264_index.h)
+ * tells where every access unit starts, frames are read on demand from the
+ * page cache without a demuxer or any copy.
+ * 
+ * frames go into a shared ring, every client (one per media) reads it
+ * through its own cursor, so N viewers share one copy of the data. a client
+ * asking past the end of the ring reads the next frame, it takes up to
+ * SOURCE_MAX_LOOKAHEAD frames per visit to the ring. the ring keeps at most
+ * SOURCE_RING_CAPACITY frames, a client that falls behind it rejoins at an IDR.
+ * 
+ * the latest GOP is never evicted, a joining client gets it as one burst 
+ * (IDR up to the live edge) and then continues frame by frame.
+ * */
+#define SOURCE_MAX_LOOKAHEAD    16
+#define SOURCE_RING_CAPACITY    256
+#define SOURCE_SPS_PROBE_SIZE   (1024*1024)
+#define SOURCE_DEFAULT_FPS      25      // raw streams without VUI timing
+
+struct H264Source
+{
+    std::shared_ptr<void>   file;                   // GMappedFile, frames hold it too
+    const uint8_t*          file_data        = nullptr;
+    size_t                  file_size        = 0;
+    H264Index               index;
+    uint64_t                next_frame       = 0;   // next index entry to read into the ring
+    bool                    eos              = false;
+
+    H264Sps                 sps;                    // leading SPS, for the initial caps
+    bool                    has_sps          = false;
+
+    /* parameter sets by id as of frame params_scanned, and the frames where
+     * they changed. filled in file order as far as any client has read */
+    H264ParamSets              param_sets;
+    uint64_t                   params_scanned = 0;
+    std::vector<uint64_t>      params_frames;
+    std::vector<H264ParamsPtr> params_history;
+
+    int64_t                 default_duration = GST_SECOND / SOURCE_DEFAULT_FPS;
+
+    ~H264Source();
+
+    std::mutex               lock;          // need-data runs on each media's streaming thread
+    std::deque<H264FramePtr> ring;
+    uint64_t                 ring_base = 0; // sequence number of ring.front()
+    std::deque<uint64_t>     idr_seqs;      // sequence numbers of the IDR frames in the ring
+};
+
+using H264SourcePtr = std::shared_ptr<H264Source>;
+
+struct H264Client
+{
+    H264SourcePtr source;
+    uint64_t    cursor    = 0;              // sequence number of the next frame to push
+    uint64_t    burst_end = 0;              // live edge when the client joined
+    bool        joined    = false;
+
+    /* source timestamps are shifted so every client starts at 0 and stays
+     * continuous when it rejoins */
+    bool        rebase    = true;
+    int64_t     ts_offset = 0;
+    int64_t     next_dts  = 0;
+
+    H264ParamsPtr params;                   // parameter sets the client has
+    uint32_t    width     = 0;              // of the caps set on the appsrc
+    uint32_t    height    = 0;
+
+    /* feeder thread, pushes until enough-data and sleeps until need-data */
+    GstElement*              appsrc  = nullptr;     // not referenced, the feeder stops before it goes
+    std::thread              feeder;
+    std::mutex               feed_lock;
+    std::condition_variable  feed_cond;
+    std::atomic<bool>        paused  {true};        // until the first need-data
+    bool                     stop    = false;
+    std::deque<H264FramePtr> pending;               // taken from the ring, not pushed yet
+    size_t                   pending_burst = 0;     // leading pending frames of a join burst
+
+    /* real-time pacing, source dts pace_ts is due at pace_wall */
+    bool                                  paced     = false;
+    std::chrono::steady_clock::time_point pace_wall;
+    int64_t                               pace_ts   = 0;
+
+    /* seek and trick play : the client leaves the shared ring and reads the
+     * mapped file at its own position. seek-data only records the request 
+     * (feed_lock), the feeder applies it */
+    std::atomic<bool> seek_pending {false};
+    int64_t     seek_target    = 0;
+    double      seek_rate      = 1.0;       // from the last seek event
+    bool        seek_key_units = false;
+    bool        eos            = false;     // drained, the feeder waits for a seek
+
+    bool        detached  = false;
+    double      rate      = 1.0;
+    bool        key_units = false;          // IDR frames only, from the index
+    size_t      key_next  = 0;              // next index entry in key unit mode
+    uint64_t    file_frame = 0;             // next index entry otherwise
+
+    guint64     pushed_bytes = 0;
+    guint64     pauses       = 0;
+    guint64     peak_level   = 0;               // appsrc current-level-bytes
+};
+
+static void h264_source_close(H264Source* src)
+{
+    src->ring.clear();
+    src->idr_seqs.clear();
+
+    /* frames still in flight keep the mapping until they are released */
+    src->file.reset();
+    src->file_data = nullptr;
+    src->file_size = 0;
+}
+
+H264Source::~H264Source()
+{
+    h264_source_close(this);
+}
 
-    if (nal_type == 5)// || nal_type == 7 || nal_type == 8 || nal_type == 2)
+static void h264_source_set_sps(H264Source* src, const H264Nal& _nal)
+{
+    H264Sps  sps;
+    uint32_t num, den;
+
+    if (!h264_sps_parse(_nal.data, _nal.size, &sps))
     {
-        return 1;
+        printf("invalid SPS, ignored\n");
+        return;
     }
-    else
+
+    src->sps     = sps;
+    src->has_sps = true;
+    if (sps.framerate(&num, &den))
     {
-        return 0;
-    }  
+        src->default_duration = gst_util_uint64_scale(GST_SECOND, den, num);
+    }
+    printf("SPS profile:%u level:%u %ux%u timing:%u/%u fixed:%d\n",
+        sps.profile_idc, sps.level_idc, sps.width, sps.height,
+        sps.time_scale, sps.num_units_in_tick, sps.fixed_frame_rate);
 }
 
+/* caps from a parsed SPS (or none), framerate 0/1 marks a variable frame rate */
+static GstCaps* h264_caps(const H264Sps* sps)
+{
+    GstCaps* caps = gst_caps_new_simple("video/x-h264",
+        "stream-format", G_TYPE_STRING, "byte-stream",
+        "alignment", G_TYPE_STRING, "au", NULL);
+    uint32_t num = 0, den = 1;
 
-struct H264Frame
+    if (sps)
+    {
+        if (!sps->fixed_frame_rate || !sps->framerate(&num, &den))
+        {
+            num = 0;
+            den = 1;
+        }
+        gst_caps_set_simple(caps,
+            "width", G_TYPE_INT, (int)sps->width,
+            "height", G_TYPE_INT, (int)sps->height,
+            "framerate", GST_TYPE_FRACTION, (int)num, (int)den, NULL);
+    }
+    return caps;
+}
+
+/* map the file and probe its leading SPS, the index is taken separately */
+static bool h264_source_map(H264Source* src, const char* filename)
 {
-    H264Frame(const uint32_t& _size)
+    GError*      error = NULL;
+    GMappedFile* mapped;
+    H264AuInfo   info;
+
+    /* map the file, pages are only touched when a frame is sent */
+    mapped = g_mapped_file_new(filename, FALSE, &error);
+    if (!mapped)
     {
-        buf = (uint8_t*)malloc(_size);
-        size = _size;
+        printf("map %s failed: %s\n", filename, error->message);
+        g_clear_error(&error);
+        return false;
     }
 
-    ~H264Frame()
+    src->file      = std::shared_ptr<void>(mapped,
+        [](void* _mapped) { g_mapped_file_unref((GMappedFile*)_mapped); });
+    src->file_data = (const uint8_t*)g_mapped_file_get_contents(mapped);
+    src->file_size = g_mapped_file_get_length(mapped);
+
+    /* raw streams have no timestamps, frames are spaced by the rate of the
+     * leading SPS when it has timing info */
+    h264_au_parse(src->file_data, MIN(src->file_size, SOURCE_SPS_PROBE_SIZE), &info);
+    if (info.sps.data)
+    {
+        h264_source_set_sps(src, info.sps);
+    }
+    return true;
+}
+
+/**
+ * parameter sets in effect at frame n. frames with in-band SPS/PPS are
+ * looked at once, in file order, a snapshot is kept only where a set
+ * changed. src->lock held
+ * */
+static H264ParamsPtr h264_source_params_at(H264Source* src, uint64_t n)
+{
+    const H264Index& index = src->index;
+
+    while (src->params_scanned <= n && src->params_scanned < index.frame_count)
     {
-        if (buf)
+        const H264IndexEntry& entry = index.frames[src->params_scanned];
+
+        if ((entry.flags & (H264_INDEX_SPS | H264_INDEX_PPS)) &&
+            h264_param_sets_update(&src->param_sets, src->file_data + entry.offset, entry.size))
         {
-            free(buf);
-            buf = nullptr;
+            std::shared_ptr<H264Params> params = std::make_shared<H264Params>();
+            const H264ParamSets&        sets   = src->param_sets;
+
+            params->annexb = h264_param_sets_annexb(&sets);
+            if (sets.last_sps >= 0)
+            {
+                const std::string& sps = sets.sps[sets.last_sps];
+                params->has_sps = h264_sps_parse((const uint8_t*)sps.data(), sps.size(), &params->sps);
+            }
+
+            if (!src->params_history.empty())
+            {
+                printf("parameter sets change at frame %llu, %ux%u\n",
+                    (unsigned long long)src->params_scanned, params->sps.width, params->sps.height);
+            }
+            src->params_frames.push_back(src->params_scanned);
+            src->params_history.push_back(params);
         }
+        src->params_scanned++;
     }
 
-    uint8_t* buf = nullptr;
-    uint32_t size;
-    bool     is_idr = false;
-    uint64_t timestamp = 0ULL;
-};
+    auto it = std::upper_bound(src->params_frames.begin(), src->params_frames.end(), n);
+    if (it == src->params_frames.begin())
+    {
+        return nullptr;
+    }
+    return src->params_history[it - src->params_frames.begin() - 1];
+}
 
-uint64_t g_timestamp = 0ULL;
+/* frame n of the index, pointing into the mapping. src->lock held */
+static H264FramePtr h264_source_frame(H264Source* src, uint64_t n)
+{
+    const H264IndexEntry& entry = src->index.frames[n];
+    H264FramePtr frame = std::allocate_shared<H264Frame>(FramePoolAllocator<H264Frame>(),
+        src->file_data + entry.offset, entry.size, src->file);
+
+    frame->pts            = entry.pts;
+    frame->dts            = entry.dts;
+    frame->duration       = src->index.frame_duration;
+    frame->is_idr         = (entry.flags & H264_INDEX_IDR) != 0;
+    frame->has_param_sets = (entry.flags & H264_INDEX_SPS) && (entry.flags & H264_INDEX_PPS);
+    frame->params         = h264_source_params_at(src, n);
+    return frame;
+}
 
-using H264FramePtr = std::shared_ptr<H264Frame>;
+static uint64_t h264_source_end(H264Source* src)
+{
+    return src->ring_base + src->ring.size();
+}
+
+/* read the next frame of the index into the ring, ring sequence numbers are
+ * frame numbers of the index */
+static bool h264_source_read_frame(H264Source* src)
+{
+    if (src->eos || src->next_frame >= src->index.frame_count)
+    {
+        src->eos = true;
+        return false;
+    }
 
-std::list<H264FramePtr> g_list;
+    H264FramePtr ptr = h264_source_frame(src, src->next_frame++);
 
-struct buffer_data {
-    uint8_t* ptr;
-    size_t size; ///< size left in the buffer
-};
+    if (ptr->is_idr)
+    {
+        src->idr_seqs.push_back(h264_source_end(src));
+    }
+    src->ring.emplace_back(ptr);
+
+    /* frames still referenced by in-flight buffers outlive the ring,
+     * the GOP of the most recent IDR stays for joining clients */
+    if (src->ring.size() > SOURCE_RING_CAPACITY && 
+        !src->idr_seqs.empty() && src->ring_base < src->idr_seqs.back())
+    {
+        src->ring.pop_front();
+        src->ring_base++;
+        while (!src->idr_seqs.empty() && src->idr_seqs.front() < src->ring_base)
+        {
+            src->idr_seqs.pop_front();
+        }
+    }
+    return true;
+}
 
-static int read_packet(void* opaque, uint8_t* buf, int buf_size)
+/* read until the ring reaches sequence number end_seq */
+static void h264_source_fill(H264Source* src, uint64_t end_seq)
 {
-    struct buffer_data* bd = (struct buffer_data*)opaque;
-    buf_size = FFMIN(buf_size, bd->size);
+    while (h264_source_end(src) < end_seq && h264_source_read_frame(src))
+    {
+    }
+}
 
-    if (!buf_size)
-        return AVERROR_EOF;
-    // printf("ptr:%p size:%zu\n", bd->ptr, bd->size);
+/* start the client at the most recent IDR in the ring */
+static bool h264_client_join(H264Client* client)
+{
+    H264Source* src = client->source.get();
 
-    /* copy internal buffer data to buf */
-    memcpy(buf, bd->ptr, buf_size);
-    bd->ptr += buf_size;
-    bd->size -= buf_size;
+    while (src->idr_seqs.empty() && h264_source_read_frame(src))
+    {
+    }
+    if (src->idr_seqs.empty())
+    {
+        return false;
+    }
 
-    return buf_size;
+    client->cursor    = src->idr_seqs.back();
+    client->burst_end = h264_source_end(src);
+    client->joined    = true;
+    client->rebase    = true;
+    printf("client %p join at frame %llu, burst %llu frames\n", client, 
+        (unsigned long long)client->cursor, 
+        (unsigned long long)(client->burst_end - client->cursor));
+    return true;
 }
 
+/* next frame for the client, nullptr once the source is drained. src->lock held */
+static H264FramePtr h264_client_next(H264Client* client)
+{
+    H264Source* src = client->source.get();
+
+    if (client->joined && client->cursor < src->ring_base)
+    {
+        printf("client %p fell behind the ring, rejoin.\n", client);
+        client->joined = false;
+    }
+    if (!client->joined && !h264_client_join(client))
+    {
+        return nullptr;
+    }
+
+    h264_source_fill(src, client->cursor + 1);
+    if (client->cursor >= h264_source_end(src))
+    {
+        return nullptr;
+    }
+
+    return src->ring[client->cursor++ - src->ring_base];
+}
+
+/* stop and join the feeder thread, safe to call more than once */
+static void h264_client_stop(H264Client* client)
+{
+    {
+        std::lock_guard<std::mutex> guard(client->feed_lock);
+        client->stop = true;
+    }
+    client->feed_cond.notify_all();
+
+    if (client->feeder.joinable())
+    {
+        client->feeder.join();
+        printf("client %p feeder stopped, pushed:%llu KB pauses:%llu peak level:%llu KB\n", client,
+            (unsigned long long)(client->pushed_bytes / 1024), (unsigned long long)client->pauses,
+            (unsigned long long)(client->peak_level / 1024));
+    }
+}
+
+static void h264_client_free(gpointer _udata)
+{
+    H264Client* client = (H264Client*)_udata;
+
+    h264_client_stop(client);
+    delete client;
+}
 
 
 #define DEFAULT_RTSP_PORT "8554"
+#define DEFAULT_INPUT_FILE "test.264"
+#define DEFAULT_MOUNT      "/test"
+#define DEFAULT_LAUNCH     "( appsrc name=myappsrc ! rtph264pay name=pay0 pt=96 config-interval=1 )"
+#define DEFAULT_LINGER_SEC 10
+#define DEFAULT_TCP_BACKLOG 512
+#define DEFAULT_TCP_BATCH  32
+#define DEFAULT_MAX_BYTES  (1024*1024)
+#define PACE_MAX_LAG_MS    1000    // a feeder further behind re-anchors instead of bursting
 
 static char* port = (char*)DEFAULT_RTSP_PORT;
+static char* input_filename = (char*)DEFAULT_INPUT_FILE;
+static char* catalog = NULL;
+static gboolean shared = FALSE;
+static gint linger_sec = DEFAULT_LINGER_SEC;
+static gint client_threads = 0;
+static gboolean tcp_only = FALSE;
+static gint tcp_backlog = DEFAULT_TCP_BACKLOG;
+static gint tcp_batch = DEFAULT_TCP_BATCH;
+static gint max_bytes = DEFAULT_MAX_BYTES;
+static gint max_latency_ms = 0;
+static gdouble pace_speed = 1.0;
+static gboolean max_speed = FALSE;
 
 static GOptionEntry entries[] = {
   {"port", 'p', 0, G_OPTION_ARG_STRING, &port,
       "Port to listen on (default: " DEFAULT_RTSP_PORT ")", "PORT"},
+  {"input", 'i', 0, G_OPTION_ARG_STRING, &input_filename,
+      "H.264 elementary stream to serve at " DEFAULT_MOUNT " (default: " DEFAULT_INPUT_FILE ")", "FILE"},
+  {"catalog", 'c', 0, G_OPTION_ARG_STRING, &catalog,
+      "Directory of .264/.h264 files or key file of [mount] location=FILE groups, one mount per source", "PATH"},
+  {"shared", 's', 0, G_OPTION_ARG_NONE, &shared,
+      "Share one pipeline per mount instead of one per client. cheaper, but a client "
+      "joining a playing mount waits for its next IDR, without the GOP burst", NULL},
+  {"linger", 'l', 0, G_OPTION_ARG_INT, &linger_sec,
+      "Seconds a --shared pipeline stays up after its last client stopped playing (default: 10)", "SEC"},
+  {"threads", 't', 0, G_OPTION_ARG_INT, &client_threads,
+      "Worker threads (each with its own main context) for client connections, 0 = one per core", "N"},
+  {"tcp", 0, 0, G_OPTION_ARG_NONE, &tcp_only,
+      "Only offer RTP over the RTSP connection (interleaved TCP), sent in batches by sender threads", NULL},
+  {"backlog", 'b', 0, G_OPTION_ARG_INT, &tcp_backlog,
+      "RTP messages queued per TCP client before they are dropped up to the next IDR (default: 512)", "N"},
+  {"batch", 0, 0, G_OPTION_ARG_INT, &tcp_batch,
+      "Messages written per TCP send call (default: 32)", "N"},
+  {"max-bytes", 0, 0, G_OPTION_ARG_INT, &max_bytes,
+      "Bytes queued in appsrc before its feeder pauses (default: 1048576)", "BYTES"},
+  {"max-latency", 0, 0, G_OPTION_ARG_INT, &max_latency_ms,
+      "Milliseconds of video queued in appsrc before its feeder pauses, 0 = bytes only", "MS"},
+  {"speed", 0, 0, G_OPTION_ARG_DOUBLE, &pace_speed,
+      "Playback speed of file sources against the wall clock, e.g. 2 or 0.5 (default: 1)", "X"},
+  {"max-speed", 0, 0, G_OPTION_ARG_NONE, &max_speed,
+      "Push file sources as fast as the pipeline takes them, for load testing clients", NULL},
   {NULL}
 };
 
-static FILE * appSrcFile = NULL;
-static int  read_counter = 0;
-static char read_buffer[4096];
+/**
+ * stream catalog : one mount per source. the source of a mount is opened
+ * when the first client configures a media for it and closed once the last
+ * client (and the last buffer referencing it) is gone, so only streams that 
+ * are being watched cost memory.
+ *
+ * frame indexes are built by the index pool, queued for every mount when the
+ * catalog is loaded. a client thread only maps a finished index and never
+ * scans a file, a client of a mount still being indexed is refused and
+ * retries later.
+ * */
+#define CATALOG_INDEX_THREADS   2
 
-static bool is_first_push = true;
- 
+struct StreamMount
+{
+    std::string                 path;       // mount point, "/name"
+    std::string                 location;   // file to serve
+    std::mutex                  lock;
+    std::weak_ptr<H264Source>   source;
+    bool                        indexing = false;   // queued in or run by the index pool
+};
 
-void need_data_callback(GstElement* _appsrc, guint _length, gpointer _udata)
+static std::vector<StreamMount*> g_mounts;
+static GThreadPool*              g_index_pool = nullptr;
+
+/* index pool : build and save the index of a mount, or just check it */
+static void catalog_index_worker(gpointer _data, gpointer _udata)
 {
-    printf("need_data_callback appsrc : %p \n", _appsrc);
-    g_print("need_data_callback\n");
+    StreamMount* mount = (StreamMount*)_data;
+    const char*  file  = mount->location.c_str();
+    H264Source   src;
 
+    if (h264_source_map(&src, file) &&
+        !h264_index_open(file, src.file_data, src.file_size, src.default_duration, &src.index))
+    {
+        printf("no IDR frame in %s\n", file);
+    }
 
-    GstBuffer* gst_buffer;
-    
+    std::lock_guard<std::mutex> guard(mount->lock);
+    mount->indexing = false;
+}
 
-    if (is_first_push)
+/* queue the index of the mount unless it is queued already. mount->lock held */
+static void catalog_index(StreamMount* mount)
+{
+    if (mount->indexing)
     {
-        while (!g_list.empty())
-        {
-            if (g_list.front()->is_idr)
-            {
-                printf("find I frame \n");
-                break;
-            }
-            else
-            {
-                printf("find P frame \n");
+        return;
+    }
+    mount->indexing = true;
+    g_thread_pool_push(g_index_pool, mount, NULL);
+}
 
-                g_list.pop_front();
-            }
-        }
-        is_first_push = false;
+static H264SourcePtr stream_mount_acquire(StreamMount* mount)
+{
+    std::lock_guard<std::mutex> guard(mount->lock);
+    const char* file = mount->location.c_str();
+
+    H264SourcePtr src = mount->source.lock();
+    if (src)
+    {
+        return src;
     }
-    
-    H264FramePtr h264_frame_ptr = g_list.front();
 
-    if (h264_frame_ptr->is_idr)
+    src = std::make_shared<H264Source>();
+    if (!h264_source_map(src.get(), file))
     {
-        printf("push I frame.\n");
-        gst_buffer = gst_buffer_new_allocate(NULL, h264_frame_ptr->size + SPS_PPS_LEN, NULL);
-        gst_buffer_fill(gst_buffer, 0, (guchar*)SPS_PPS_BUFFER, SPS_PPS_LEN);
-        gst_buffer_fill(gst_buffer, SPS_PPS_LEN, (guchar*)h264_frame_ptr->buf, h264_frame_ptr->size);
+        return nullptr;
     }
-    else
+
+    /* frame index, from the sidecar when it is up to date. a missing one
+     * is built by the index pool, never here on the client thread */
+    if (!h264_index_load(file, src->default_duration, &src->index))
+    {
+        printf("index of %s not ready, %s is still indexing\n", file, mount->path.c_str());
+        catalog_index(mount);
+        return nullptr;
+    }
+    if (src->index.keyframe_count == 0)
     {
-        printf("push p frame.\n");
-        gst_buffer = gst_buffer_new_allocate(NULL, h264_frame_ptr->size, NULL);
-        gst_buffer_fill(gst_buffer, 0, (guchar*)h264_frame_ptr->buf, h264_frame_ptr->size);
+        printf("no IDR frame in %s\n", file);
+        return nullptr;
     }
+    printf("open %s for %s\n", file, mount->path.c_str());
 
+    mount->source = src;
+    return src;
+}
 
-    GST_BUFFER_PTS(gst_buffer) = g_timestamp;
-    GST_BUFFER_DTS(gst_buffer) = GST_BUFFER_PTS(gst_buffer);
-    g_timestamp += (1000000000UL / 25UL);
+static void catalog_add(const std::string& _path, const std::string& _location)
+{
+    StreamMount* mount = new StreamMount();
+    mount->path     = _path;
+    mount->location = _location;
+    g_mounts.push_back(mount);
+}
 
-    int ret = -1;
-    g_signal_emit_by_name(_appsrc, "push-buffer", gst_buffer, &ret);
-    gst_buffer_unref(gst_buffer);
+/* every .264/.h264 file of the directory becomes /<file name without extension> */
+static bool catalog_scan_dir(const char* _dir)
+{
+    GError* error = NULL;
+    GDir* dir = g_dir_open(_dir, 0, &error);
+    const gchar* name;
 
-    g_list.pop_front();
+    if (!dir)
+    {
+        g_printerr("open catalog %s failed: %s\n", _dir, error->message);
+        g_clear_error(&error);
+        return false;
+    }
 
-    printf("need end. ret:%d \n", ret);
+    while ((name = g_dir_read_name(dir)))
+    {
+        std::string file = name;
+        size_t dot = file.rfind('.');
+        if (dot == std::string::npos || dot == 0 ||
+            (file.compare(dot, std::string::npos, ".264") != 0 &&
+             file.compare(dot, std::string::npos, ".h264") != 0))
+        {
+            continue;
+        }
 
+        gchar* location = g_build_filename(_dir, name, NULL);
+        catalog_add("/" + file.substr(0, dot), location);
+        g_free(location);
+    }
+
+    g_dir_close(dir);
+    return true;
 }
 
-void enough_data_callback(GstElement* _appsrc, guint _length, gpointer _udata)
+/**
+ * key file catalog, one group per mount :
+ *   [camera1]
+ *   location=/data/camera1.264
+ * */
+static bool catalog_load_file(const char* _file)
 {
-    g_print("enough_data_callback\n");
+    GError* error = NULL;
+    GKeyFile* key_file = g_key_file_new();
+    gchar** groups;
+
+    if (!g_key_file_load_from_file(key_file, _file, G_KEY_FILE_NONE, &error))
+    {
+        g_printerr("load catalog %s failed: %s\n", _file, error->message);
+        g_clear_error(&error);
+        g_key_file_free(key_file);
+        return false;
+    }
+
+    groups = g_key_file_get_groups(key_file, NULL);
+    for (gchar** group = groups; *group; group++)
+    {
+        gchar* location = g_key_file_get_string(key_file, *group, "location", NULL);
+        if (!location)
+        {
+            g_printerr("catalog entry [%s] has no location, skipped\n", *group);
+            continue;
+        }
+        catalog_add(std::string("/") + *group, location);
+        g_free(location);
+    }
+
+    g_strfreev(groups);
+    g_key_file_free(key_file);
+    return true;
 }
 
 
-void media_configure_callback(GstRTSPMediaFactory* _factory, GstRTSPMedia* _media, gpointer _udata)
+/* pooled shared reference handed to a GstMemory as its user data */
+template <class T>
+static gpointer pool_hold(const std::shared_ptr<T>& _ptr)
 {
-    g_print("media_configure_callback \n");
+    void* holder = FramePool::instance().allocate(sizeof(std::shared_ptr<T>));
+    return new (holder) std::shared_ptr<T>(_ptr);
+}
 
-    GstElement* element;
-    GstElement* appsrc;
+/* GstMemory release notify, drops the reference the memory held */
+template <class T>
+static void pool_release(gpointer _udata)
+{
+    std::shared_ptr<T>* holder = (std::shared_ptr<T>*)_udata;
 
-    element = gst_rtsp_media_get_element(_media);
-    appsrc = gst_bin_get_by_name_recurse_up(GST_BIN(element), "myappsrc");
-    if (!G_IS_OBJECT(appsrc))
+    holder->~shared_ptr<T>();
+    FramePool::instance().deallocate(holder, sizeof(std::shared_ptr<T>));
+}
+
+/* wrap the frame payload without copying, the buffer keeps the frame alive.
+ * with_params puts the frame's parameter sets in front, also without a copy */
+static GstBuffer* h264_frame_wrap(const H264FramePtr& _frame, bool with_params)
+{
+    GstBuffer* gst_buffer = frame_buffer_acquire();
+
+    gst_buffer_append_memory(gst_buffer,
+        gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+            _frame->buf, _frame->size, 0, _frame->size,
+            pool_hold(_frame), pool_release<H264Frame>));
+
+    if (with_params)
     {
-        g_print("not find aapsrc  \n");
+        const std::string& annexb = _frame->params->annexb;
+        gst_buffer_prepend_memory(gst_buffer,
+            gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+                (gpointer)annexb.data(), annexb.size(), 0, annexb.size(),
+                pool_hold(_frame->params), pool_release<const H264Params>));
     }
-    printf(" appsrc : %p \n", appsrc);
-    g_print("find success.\n");
-    
-      /* this instructs appsrc that we will be dealing with timed buffer */
-    gst_util_set_object_arg(G_OBJECT(appsrc), "format", "time");
 
+    return gst_buffer;
+}
 
-    g_object_set(G_OBJECT(appsrc), "caps",
-        gst_caps_new_simple("video/x-h264",
-            "stream-format", G_TYPE_STRING, "byte-stream",
-            "width", G_TYPE_INT, 384,
-            "height", G_TYPE_INT, 288,
-            "alignment", G_TYPE_STRING, "au",
-            "framerate", GST_TYPE_FRACTION, 25, 1, NULL), NULL);
+/**
+ * parameter sets go to a client when it joins (or seeks) and when they
+ * change, in front of the next IDR that does not carry them in-band. a
+ * changed SPS also changes the caps.
+ * */
+static bool h264_client_need_params(H264Client* client, const H264FramePtr& _frame)
+{
+    const H264ParamsPtr& params = _frame->params;
+    bool send = false;
 
-    g_signal_connect(appsrc, "need-data", (GCallback)(need_data_callback), NULL);
-    g_signal_connect(appsrc, "enough-data", (GCallback)(enough_data_callback), NULL);
+    if (!params || params == client->params)
+    {
+        return false;
+    }
 
-    gst_object_unref(appsrc);
-    gst_object_unref(element);
+    if (_frame->has_param_sets)
+    {
+        client->params = params;
+    }
+    else if (_frame->is_idr)
+    {
+        client->params = params;
+        send = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (params->has_sps && 
+        (params->sps.width != client->width || params->sps.height != client->height))
+    {
+        GstCaps* caps = h264_caps(&params->sps);
+        gst_app_src_set_caps(GST_APP_SRC(client->appsrc), caps);
+        gst_caps_unref(caps);
+        client->width  = params->sps.width;
+        client->height = params->sps.height;
+    }
+    return send;
 }
 
+static GstFlowReturn h264_client_push(H264Client* client, const H264FramePtr& _frame)
+{
+    GstBuffer* gst_buffer = h264_frame_wrap(_frame, h264_client_need_params(client, _frame));
 
+    if (client->rebase)
+    {
+        client->ts_offset = client->next_dts - _frame->dts;
+        client->rebase    = false;
+    }
 
-int
-main(int argc, char* argv[])
+    GST_BUFFER_DTS(gst_buffer)      = (GstClockTime)(_frame->dts + client->ts_offset);
+    GST_BUFFER_PTS(gst_buffer)      = (GstClockTime)(_frame->pts + client->ts_offset);
+    GST_BUFFER_DURATION(gst_buffer) = (GstClockTime)_frame->duration;
+    if (!_frame->is_idr)
+    {
+        GST_BUFFER_FLAG_SET(gst_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    if (client->key_units)
+    {
+        /* every key frame stands alone, also when played backwards */
+        GST_BUFFER_FLAG_SET(gst_buffer, GST_BUFFER_FLAG_DISCONT);
+    }
+    client->next_dts = _frame->dts + client->ts_offset + _frame->duration;
+
+    /* takes the buffer */
+    return gst_app_src_push_buffer(GST_APP_SRC(client->appsrc), gst_buffer);
+}
+
+/* frames for the next round of pushes, src->lock held */
+static void h264_client_take(H264Client* client)
+{
+    H264FramePtr frame;
+
+    /* a client that just joined gets the cached GOP in one go */
+    while ((client->pending.size() < SOURCE_MAX_LOOKAHEAD || client->cursor < client->burst_end) &&
+           (frame = h264_client_next(client)))
+    {
+        client->pending.push_back(frame);
+        if (client->cursor <= client->burst_end)
+        {
+            client->pending_burst = client->pending.size();
+        }
+    }
+}
+
+/* reposition a client on the keyframe at or before target (file timeline) */
+static void h264_client_seek(H264Client* client, int64_t target, double rate, bool key_units)
 {
-    //////////////////////////////////////////////////////////////////////////////
+    H264Source* src = client->source.get();
+    size_t      key = h264_index_find(&src->index, target);
+    const H264IndexEntry& entry = src->index.keyframe(key);
+
+    client->detached   = true;
+    client->rate       = rate;
+    client->key_units  = key_units;
+    client->key_next   = key;
+    client->file_frame = src->index.keyframes[key];
+    client->eos        = false;
+
+    /* timestamps are file positions from now on, as the new segment expects */
+    client->pending.clear();
+    client->pending_burst = 0;
+    client->paced     = false;
+    client->rebase    = false;
+    client->ts_offset = 0;
+    client->next_dts  = entry.dts;
+    client->params.reset();
+
+    printf("client %p seek %.3fs -> keyframe %u at %.3fs, rate %.2f%s\n", client,
+        target / (double)GST_SECOND, src->index.keyframes[key], entry.pts / (double)GST_SECOND,
+        rate, key_units ? " key units" : "");
+}
 
+/* next frame of a detached client, straight from the index. src->lock held */
+static H264FramePtr h264_client_next_mapped(H264Client* client)
+{
+    H264Source*      src   = client->source.get();
+    const H264Index& index = src->index;
+    H264FramePtr     frame;
 
-    AVFormatContext* fmt_ctx = NULL;
-    AVIOContext* avio_ctx = NULL;
-    uint8_t* buffer = NULL, * avio_ctx_buffer = NULL;
-    size_t buffer_size, avio_ctx_buffer_size = 4096;
-    char* input_filename = NULL;
-    int ret = 0;
-    struct buffer_data bd = { 0 };
+    if (client->key_units)
+    {
+        /* backwards, key_next wraps past 0 and ends the stream as well */
+        if (client->key_next >= index.keyframe_count)
+        {
+            return nullptr;
+        }
 
+        int64_t next_pts = client->key_next + 1 < index.keyframe_count
+            ? index.keyframe(client->key_next + 1).pts : index.duration();
 
-    input_filename = "test.264";
+        frame = h264_source_frame(src, index.keyframes[client->key_next]);
+        frame->duration = next_pts - frame->pts;     // the key frame stands for its GOP
 
-    /* slurp file content into buffer */
-    ret = av_file_map(input_filename, &buffer, &buffer_size, 0, NULL);
-    // if (ret < 0)
-    //     goto end;
+        client->key_next += client->rate < 0 ? -1 : 1;
+        return frame;
+    }
 
-    /* fill opaque structure used by the AVIOContext read callback */
-    bd.ptr = buffer;
-    bd.size = buffer_size;
+    if (client->file_frame >= index.frame_count)
+    {
+        return nullptr;
+    }
+    return h264_source_frame(src, client->file_frame++);
+}
 
-    if (!(fmt_ctx = avformat_alloc_context())) {
-        // ret = AVERROR(ENOMEM);
-        // goto end;
+static void h264_client_take_mapped(H264Client* client)
+{
+    H264FramePtr frame;
+
+    /* the frames look up their parameter sets in the source */
+    std::lock_guard<std::mutex> guard(client->source->lock);
+    while (client->pending.size() < SOURCE_MAX_LOOKAHEAD && (frame = h264_client_next_mapped(client)))
+    {
+        client->pending.push_back(frame);
     }
+}
+
+/**
+ * real-time pacing : the wall clock is locked to the dts of the first frame
+ * pushed (the live edge after a join burst) and every later frame waits 
+ * until its dts, scaled by pace_speed and the playback rate, is due. burst
+ * frames go out at once and re-anchor the clock. false if the wait was cut
+ * short by a stop or a seek.
+ * */
+static bool h264_client_pace(H264Client* client, const H264FramePtr& _frame)
+{
+    using namespace std::chrono;
 
-    avio_ctx_buffer = (uint8_t*)av_malloc(avio_ctx_buffer_size);
-    if (!avio_ctx_buffer) {
-        ret = AVERROR(ENOMEM);
-        // goto end;
+    if (max_speed)
+    {
+        return true;
     }
-    avio_ctx = avio_alloc_context(avio_ctx_buffer, avio_ctx_buffer_size,
-        0, &bd, &read_packet, NULL, NULL);
-    if (!avio_ctx) {
-        // ret = AVERROR(ENOMEM);
-        // goto end;
+
+    steady_clock::time_point now = steady_clock::now();
+    if (client->pending_burst > 0 || !client->paced)
+    {
+        client->paced     = true;
+        client->pace_wall = now;
+        client->pace_ts   = _frame->dts;
+        return true;
     }
-    fmt_ctx->pb = avio_ctx;
 
-    ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL);
-    if (ret < 0) {
-        // fprintf(stderr, "Could not open input\n");
-        // goto end;
+    /* reverse trick play walks the timeline backwards */
+    int64_t elapsed = client->rate < 0 ? client->pace_ts - _frame->dts : _frame->dts - client->pace_ts;
+    steady_clock::time_point due = client->pace_wall + 
+        nanoseconds((int64_t)(elapsed / (pace_speed * fabs(client->rate))));
+    if (due + milliseconds(PACE_MAX_LAG_MS) < now)
+    {
+        /* stalled (paused or a slow pipeline), continue from here */
+        printf("client %p %lld ms behind, re-anchor pacing\n", client,
+            (long long)duration_cast<milliseconds>(now - due).count());
+        client->pace_wall = now;
+        client->pace_ts   = _frame->dts;
+        return true;
     }
 
-    ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    std::unique_lock<std::mutex> guard(client->feed_lock);
+    return !client->feed_cond.wait_until(guard, due, 
+        [client] { return client->stop || client->seek_pending; });
+}
+
+/**
+ * feeder thread of one media. pushes while appsrc wants data, so the 
+ * payloader stays busy without a need-data round trip per frame, and 
+ * sleeps from enough-data (appsrc reached max-bytes / max-time) until the 
+ * next need-data, so the appsrc queue stays bounded. after the end of the
+ * stream it stays around for a seek.
+ * */
+static void h264_client_feed(H264Client* client)
+{
+    H264Source* src = client->source.get();
 
-    // av_dump_format(fmt_ctx, 0, input_filename, 0);
-    AVPacket packet;
-    bool first_read = true;
-    while (ret >= 0)
+    while (true)
     {
-        if (av_read_frame(fmt_ctx, &packet) < 0)
         {
-            break;
+            std::unique_lock<std::mutex> guard(client->feed_lock);
+            client->feed_cond.wait(guard, [client] { 
+                return client->stop || client->seek_pending || (!client->paused && !client->eos); });
+            if (client->stop)
+            {
+                return;
+            }
+            if (client->seek_pending)
+            {
+                client->seek_pending = false;
+                h264_client_seek(client, client->seek_target, client->seek_rate, client->seek_key_units);
+                continue;
+            }
         }
-        
-        static int k = 0;
-        if (packet.stream_index == 0)
+
+        if (client->pending.empty())
         {
-            
-            if(first_read)
+            if (client->detached)
             {
-                memcpy(SPS_PPS_BUFFER, packet.data, SPS_PPS_LEN);
-                H264FramePtr ptr = H264FramePtr(new H264Frame(packet.size - SPS_PPS_LEN));
-                memcpy(ptr->buf, packet.data + SPS_PPS_LEN, packet.size - SPS_PPS_LEN);
-                first_read = false;
-                g_list.emplace_back(ptr);
+                h264_client_take_mapped(client);
             }
             else
             {
-                // printf("frame size:%d\n", packet.size);
-                H264FramePtr ptr = H264FramePtr(new H264Frame(packet.size));
-                memcpy(ptr->buf, packet.data, packet.size);
-                g_list.emplace_back(ptr);
+                std::lock_guard<std::mutex> guard(src->lock);
+                h264_client_take(client);
             }
-            k++;
+        }
 
+        if (client->pending.empty())
+        {
+            g_print("source drained, end of stream.\n");
+            gst_app_src_end_of_stream(GST_APP_SRC(client->appsrc));
+            std::lock_guard<std::mutex> guard(client->feed_lock);
+            client->eos = true;
+            continue;
         }
 
-        // printf("k = %d\n", k);
+        while (!client->pending.empty() && !client->paused && !client->seek_pending)
+        {
+            if (!h264_client_pace(client, client->pending.front()))
+            {
+                break;
+            }
+
+            uint32_t      size = client->pending.front()->size;
+            GstFlowReturn ret  = h264_client_push(client, client->pending.front());
+
+            if (ret != GST_FLOW_OK)
+            {
+                /* flushing or shutting down, wait for the next need-data */
+                printf("client %p push %s, wait\n", client, gst_flow_get_name(ret));
+                std::lock_guard<std::mutex> guard(client->feed_lock);
+                client->paused = true;
+                break;
+            }
+            client->pending.pop_front();
+            client->pushed_bytes += size;
+            if (client->pending_burst > 0)
+            {
+                client->pending_burst--;
+            }
+        }
+
+        client->peak_level = MAX(client->peak_level,
+            gst_app_src_get_current_level_bytes(GST_APP_SRC(client->appsrc)));
+    }
+}
+
+void need_data_callback(GstElement* _appsrc, guint _length, gpointer _udata)
+{
+    H264Client* client = (H264Client*)_udata;
+
+    {
+        std::lock_guard<std::mutex> guard(client->feed_lock);
+        client->paused = false;
+    }
+    client->feed_cond.notify_one();
+}
+
+void enough_data_callback(GstElement* _appsrc, gpointer _udata)
+{
+    H264Client* client = (H264Client*)_udata;
+
+    std::lock_guard<std::mutex> guard(client->feed_lock);
+    client->paused = true;
+    client->pauses++;
+}
 
-        av_packet_unref(&packet);
+/**
+ * seek events pass the appsrc src pad on their way upstream. seek-data only
+ * carries the position, so keep the rate and trick mode of the event : rates
+ * above 1 and reverse play send IDR frames only, slow motion sends all frames.
+ * */
+static GstPadProbeReturn appsrc_seek_probe(GstPad* _pad, GstPadProbeInfo* _info, gpointer _udata)
+{
+    H264Client* client = (H264Client*)_udata;
+    GstEvent*   event  = GST_PAD_PROBE_INFO_EVENT(_info);
+
+    if (GST_EVENT_TYPE(event) == GST_EVENT_SEEK)
+    {
+        gdouble      rate;
+        GstFormat    format;
+        GstSeekFlags flags;
+        GstSeekType  start_type, stop_type;
+        gint64       start, stop;
+
+        gst_event_parse_seek(event, &rate, &format, &flags, &start_type, &start, &stop_type, &stop);
+
+        std::lock_guard<std::mutex> guard(client->feed_lock);
+        client->seek_rate      = rate;
+        client->seek_key_units = (flags & GST_SEEK_FLAG_TRICKMODE_KEY_UNITS) || rate < 0 || rate > 1;
     }
-    int i = 0;
-    printf("-----------------------------------------\n");
-    for(auto var : g_list)
+    return GST_PAD_PROBE_OK;
+}
+
+/* position is on the file timeline, the keyframe index turns it into a byte offset */
+gboolean seek_data_callback(GstElement* _appsrc, guint64 _offset, gpointer _udata)
+{
+    H264Client* client = (H264Client*)_udata;
+    bool        joined;
+
     {
-        if((var->buf[4] & 0x1f) == 5UL)
+        std::lock_guard<std::mutex> guard(client->source->lock);
+        joined = client->joined;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(client->feed_lock);
+
+        /* the PLAY of a new client usually asks for npt=0-, that is where its
+         * timeline starts anyway, so it stays on the shared ring */
+        if (!client->detached && !joined && _offset == 0 && client->seek_rate == 1.0)
         {
-            var->is_idr = true;
-            // printf("idr index:%d\n",i );
+            return TRUE;
         }
-        i++;
+
+        client->seek_target  = (int64_t)_offset;
+        client->seek_pending = true;
+    }
+    client->feed_cond.notify_one();
+    return TRUE;
+}
+
+/* the pipeline is torn down, the feeder must not touch the appsrc anymore */
+static void media_feeder_unprepared_callback(GstRTSPMedia* _media, gpointer _udata)
+{
+    h264_client_stop((H264Client*)_udata);
+}
+
+
+/**
+ * shared media linger : while a shared media is playing we hold one extra
+ * prepare count on it. when it stops playing (last client gone) a timer
+ * drops that count after linger_sec, so a client coming back within the
+ * linger time finds the pipeline still prepared instead of rebuilding it.
+ * */
+struct MediaLinger
+{
+    GstRTSPMedia* media = nullptr;      // not referenced, the linger lives on the media
+    std::mutex    lock;
+    bool          held  = false;
+    guint         timer = 0;
+};
+
+static void media_linger_free(gpointer _udata)
+{
+    delete (MediaLinger*)_udata;
+}
+
+static void media_linger_timer_done(gpointer _udata)
+{
+    MediaLinger* linger = (MediaLinger*)_udata;
+    g_object_unref(linger->media);
+}
+
+static gboolean media_linger_expired(gpointer _udata)
+{
+    MediaLinger* linger = (MediaLinger*)_udata;
+    bool release;
+
+    {
+        std::lock_guard<std::mutex> guard(linger->lock);
+        release       = linger->held;
+        linger->held  = false;
+        linger->timer = 0;
     }
 
+    if (release)
+    {
+        g_print("media %p linger expired, unprepare\n", linger->media);
+        gst_rtsp_media_unprepare(linger->media);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void media_new_state_callback(GstRTSPMedia* _media, gint _state, gpointer _udata)
+{
+    MediaLinger* linger = (MediaLinger*)_udata;
+    bool hold = false;
+
+    {
+        std::lock_guard<std::mutex> guard(linger->lock);
 
+        if (_state == GST_STATE_PLAYING)
+        {
+            if (linger->timer)
+            {
+                g_source_remove(linger->timer);
+                linger->timer = 0;
+            }
+            hold = !linger->held;
+            linger->held = true;
+        }
+        else if (linger->held && !linger->timer)
+        {
+            /* the timer keeps the media alive until it fired or got removed */
+            g_object_ref(_media);
+            linger->timer = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT, linger_sec,
+                media_linger_expired, linger, media_linger_timer_done);
+        }
+    }
+
+    /* the media is prepared, this only takes another prepare count */
+    if (hold)
+    {
+        gst_rtsp_media_prepare(_media, NULL);
+    }
+}
+
+static void media_unprepared_callback(GstRTSPMedia* _media, gpointer _udata)
+{
+    MediaLinger* linger = (MediaLinger*)_udata;
+    std::lock_guard<std::mutex> guard(linger->lock);
+
+    if (linger->timer)
+    {
+        g_source_remove(linger->timer);
+        linger->timer = 0;
+    }
+    linger->held = false;
+}
+
+void media_configure_callback(GstRTSPMediaFactory* _factory, GstRTSPMedia* _media, gpointer _udata)
+{
+    g_print("media_configure_callback \n");
+
+    GstElement* element;
+    GstElement* appsrc;
+
+    element = gst_rtsp_media_get_element(_media);
+    appsrc = gst_bin_get_by_name_recurse_up(GST_BIN(element), "myappsrc");
+    if (!G_IS_OBJECT(appsrc))
+    {
+        g_print("not find aapsrc  \n");
+        gst_object_unref(element);
+        return;
+    }
+    printf(" appsrc : %p \n", appsrc);
+    g_print("find success.\n");
+    
+      /* this instructs appsrc that we will be dealing with timed buffer */
+    gst_util_set_object_arg(G_OBJECT(appsrc), "format", "time");
+
+
+    StreamMount* mount = (StreamMount*)_udata;
+    H264SourcePtr src = stream_mount_acquire(mount);
+    if (!src)
+    {
+        g_print("open %s for %s failed\n", mount->location.c_str(), mount->path.c_str());
+        gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+        gst_object_unref(appsrc);
+        gst_object_unref(element);
+        return;
+    }
+
+    GstCaps* caps;
+    {
+        std::lock_guard<std::mutex> guard(src->lock);
+        caps = h264_caps(src->has_sps ? &src->sps : NULL);
+    }
+    g_object_set(G_OBJECT(appsrc), "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    /* enough-data fires once the queue holds max-bytes, or max-latency worth
+     * of buffers where appsrc supports max-time (1.20) */
+    gst_app_src_set_max_bytes(GST_APP_SRC(appsrc), (guint64)max_bytes);
+    if (max_latency_ms > 0)
+    {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(appsrc), "max-time"))
+        {
+            g_object_set(G_OBJECT(appsrc), "max-time", 
+                (guint64)max_latency_ms * GST_MSECOND, NULL);
+        }
+        else
+        {
+            g_print("appsrc has no max-time, --max-latency ignored\n");
+        }
+    }
+
+    /* every media reads the shared source through its own cursor, the client
+     * state is freed together with the appsrc that emits the signals and 
+     * holds the source open until then */
+    H264Client* client = new H264Client();
+    client->source = src;
+    client->appsrc = appsrc;
+    client->width  = src->has_sps ? src->sps.width : 0;
+    client->height = src->has_sps ? src->sps.height : 0;
+    g_object_set_data_full(G_OBJECT(appsrc), "h264-client", client, h264_client_free);
+
+    g_signal_connect(appsrc, "need-data", (GCallback)(need_data_callback), client);
+    g_signal_connect(appsrc, "enough-data", (GCallback)(enough_data_callback), client);
+    g_signal_connect(_media, "unprepared", (GCallback)(media_feeder_unprepared_callback), client);
+
+    /* the frame index lets the mount seek (Range) and trick play (Scale) */
+    {
+        GstPad* pad = gst_element_get_static_pad(appsrc, "src");
+
+        gst_app_src_set_stream_type(GST_APP_SRC(appsrc), GST_APP_STREAM_TYPE_SEEKABLE);
+        gst_app_src_set_duration(GST_APP_SRC(appsrc), (GstClockTime)src->index.duration());
+        g_signal_connect(appsrc, "seek-data", (GCallback)(seek_data_callback), client);
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, appsrc_seek_probe, client, NULL);
+        gst_object_unref(pad);
+    }
+    client->feeder = std::thread(h264_client_feed, client);
+
+    /* shared media : configured once, all clients of the mount hang off the
+     * same payloader and the RTP packets fan out per transport */
+    if (shared && linger_sec > 0)
+    {
+        MediaLinger* linger = new MediaLinger();
+        linger->media = _media;
+        g_object_set_data_full(G_OBJECT(_media), "media-linger", linger, media_linger_free);
+
+        g_signal_connect(_media, "new-state", (GCallback)(media_new_state_callback), linger);
+        g_signal_connect(_media, "unprepared", (GCallback)(media_unprepared_callback), linger);
+    }
+
+    gst_object_unref(appsrc);
+    gst_object_unref(element);
+}
+
+
+#define STATS_INTERVAL_SEC 10
+#define SESSION_CLEANUP_SEC 2
+
+static gboolean print_stats_callback(gpointer _udata)
+{
+    FramePoolStats pool = FramePool::instance().stats();
+
+    printf("frame pool: allocs:%llu frees:%llu hits:%llu misses:%llu oversize:%llu slabs:%llu KB gst buffers:%llu\n",
+        (unsigned long long)pool.allocs, (unsigned long long)pool.frees,
+        (unsigned long long)pool.hits, (unsigned long long)pool.misses,
+        (unsigned long long)pool.oversize, (unsigned long long)(pool.slab_bytes / 1024),
+        (unsigned long long)frame_buffer_allocated());
+
+    if (tcp_only)
+    {
+        tcp_sender_print_stats();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* the client installs its own send function when it is attached, so take
+ * over once it has a session and before any RTP is sent */
+static void client_new_session_callback(GstRTSPClient* _client, GstRTSPSession* _session, gpointer _udata)
+{
+    if (g_object_get_data(G_OBJECT(_client), "tcp-sender"))
+    {
+        return;
+    }
+    g_object_set_data(G_OBJECT(_client), "tcp-sender", GINT_TO_POINTER(1));
+    tcp_sender_attach(_client);
+}
+
+static void client_connected_callback(GstRTSPServer* _server, GstRTSPClient* _client, gpointer _udata)
+{
+    g_signal_connect(_client, "new-session", (GCallback)(client_new_session_callback), NULL);
+}
+
+/* expire timed out sessions, runs on the default context with the listener */
+static gboolean session_cleanup_callback(gpointer _udata)
+{
+    GstRTSPServer* server = (GstRTSPServer*)_udata;
+    GstRTSPSessionPool* pool = gst_rtsp_server_get_session_pool(server);
+
+    gst_rtsp_session_pool_cleanup(pool);
+    g_object_unref(pool);
+    return G_SOURCE_CONTINUE;
+}
+
+int
+main(int argc, char* argv[])
+{
     GMainLoop* loop;
     GstRTSPServer* server;
     GstRTSPMountPoints* mounts;
     GstRTSPMediaFactory* factory;
+    GstRTSPThreadPool* thread_pool;
     GOptionContext* optctx;
     GError* error = NULL;
 
@@ -361,6 +1373,37 @@ main(int argc, char* argv[])
     }
     g_option_context_free(optctx);
 
+    if (!max_speed && pace_speed <= 0)
+    {
+        g_printerr("--speed must be greater than 0\n");
+        return -1;
+    }
+
+    if (!catalog)
+    {
+        catalog_add(DEFAULT_MOUNT, input_filename);
+    }
+    else if (g_file_test(catalog, G_FILE_TEST_IS_DIR) ? 
+        !catalog_scan_dir(catalog) : !catalog_load_file(catalog))
+    {
+        return -1;
+    }
+
+    if (g_mounts.empty())
+    {
+        g_printerr("no streams in catalog %s\n", catalog);
+        return -1;
+    }
+
+    /* check or build every index in the background, mounts with an up to
+     * date sidecar are done at once */
+    g_index_pool = g_thread_pool_new(catalog_index_worker, NULL, CATALOG_INDEX_THREADS, FALSE, NULL);
+    for (StreamMount* mount : g_mounts)
+    {
+        std::lock_guard<std::mutex> guard(mount->lock);
+        catalog_index(mount);
+    }
+
     loop = g_main_loop_new(NULL, FALSE);
 
     /* create a server instance */
@@ -371,33 +1414,69 @@ main(int argc, char* argv[])
      * that be used to map uri mount points to media factories */
     mounts = gst_rtsp_server_get_mount_points(server);
 
-    /* make a media factory for a test stream. The default media factory can use
+    /* make a media factory per mount. The default media factory can use
      * gst-launch syntax to create pipelines.
      * any launch line works as long as it contains elements named pay%d. Each
      * element with pay%d names will be a stream */
-    factory = gst_rtsp_media_factory_new();
-    gst_rtsp_media_factory_set_launch(factory, argv[1]);
-
+    for (StreamMount* mount : g_mounts)
+    {
+        factory = gst_rtsp_media_factory_new();
+        gst_rtsp_media_factory_set_launch(factory, argc > 1 ? argv[1] : DEFAULT_LAUNCH);
+        /* exclusive by default : every client gets its own cursor, so it
+         * starts on an IDR with the GOP burst instead of joining mid-GOP */
+        gst_rtsp_media_factory_set_shared(factory, shared);
+        if (tcp_only)
+        {
+            gst_rtsp_media_factory_set_protocols(factory, GST_RTSP_LOWER_TRANS_TCP);
+        }
 
-    g_signal_connect(factory,
-        "media-configure",
-        (GCallback)(media_configure_callback),
-        NULL);
+        g_signal_connect(factory,
+            "media-configure",
+            (GCallback)(media_configure_callback),
+            mount);
 
-    /* attach the test factory to the /test url */
-    gst_rtsp_mount_points_add_factory(mounts, "/test", factory);
+        gst_rtsp_mount_points_add_factory(mounts, mount->path.c_str(), factory);
+        g_print("stream ready at rtsp://127.0.0.1:%s%s\n", port, mount->path.c_str());
+    }
 
     /* don't need the ref to the mapper anymore */
     g_object_unref(mounts);
 
+    /* connections are accepted on the default maincontext and then handed
+     * to a pool of worker threads, each running its own maincontext. clients
+     * are spread over the threads, once all exist they are reused round robin */
+    if (client_threads <= 0)
+    {
+        client_threads = (gint)g_get_num_processors();
+    }
+    thread_pool = gst_rtsp_server_get_thread_pool(server);
+    gst_rtsp_thread_pool_set_max_threads(thread_pool, client_threads);
+    g_object_unref(thread_pool);
+    g_print("%d client threads\n", client_threads);
+    if (max_speed)
+    {
+        g_print("pacing off, sources are pushed at max speed\n");
+    }
+    else
+    {
+        g_print("sources paced at %.2fx real time\n", pace_speed);
+    }
+
+    if (tcp_only)
+    {
+        tcp_sender_init((guint)client_threads, (guint)MAX(tcp_backlog, 1), (guint)MAX(tcp_batch, 1));
+        g_signal_connect(server, "client-connected", (GCallback)(client_connected_callback), NULL);
+        g_print("RTP over TCP only, backlog %d batch %d\n", tcp_backlog, tcp_batch);
+    }
+
     /* attach the server to the default maincontext */
     gst_rtsp_server_attach(server, NULL);
 
     /* start serving */
-    g_print("stream ready at rtsp://127.0.0.1:%s/test\n", port);
-
-
+    g_print("%u streams ready\n", (unsigned)g_mounts.size());
 
+    g_timeout_add_seconds(STATS_INTERVAL_SEC, print_stats_callback, NULL);
+    g_timeout_add_seconds(SESSION_CLEANUP_SEC, session_cleanup_callback, server);
 
     g_main_loop_run(loop);
 
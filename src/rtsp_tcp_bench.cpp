@@ -0,0 +1,197 @@
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+#include "rtsp_tcp_sender.h"
+
+/**
+ * packets-per-second benchmark of the interleaved RTP write path of
+ * rtsp_server --tcp. RTP sized messages, serialized once, go through
+ * tcp_sender_write, the call a sender thread makes per batch, over a local
+ * socket pair while a reader thread drains the other end. a full socket is
+ * waited for here, where the server hands the client to its poll thread.
+ * one run per batch size, batch 1 is one write per packet.
+ *
+ * ./rtsp_tcp_bench
+ * ./rtsp_tcp_bench -n 1000000 -s 1200
+ * */
+
+#define TAG "rtsp_tcp_bench"
+
+#define BENCH_DEFAULT_PACKETS   200000
+#define BENCH_DEFAULT_SIZE      1400
+#define BENCH_INTERLEAVED_HEAD  4           // '$', channel, 16 bit length
+
+static gint g_packets = BENCH_DEFAULT_PACKETS;
+static gint g_size    = BENCH_DEFAULT_SIZE;
+
+static GOptionEntry entries[] = {
+  {"packets", 'n', 0, G_OPTION_ARG_INT, &g_packets,
+      "RTP packets written per batch size (default: 200000)", "N"},
+  {"size", 's', 0, G_OPTION_ARG_INT, &g_size,
+      "RTP packet size in bytes (default: 1400)", "BYTES"},
+  {NULL}
+};
+
+static const guint g_batches[] = { 1, 8, 32, 64 };
+
+static void drain(int _fd, guint64 _bytes)
+{
+    std::vector<char> buffer(1024 * 1024);
+    guint64           total = 0;
+
+    while (total < _bytes)
+    {
+        ssize_t n = read(_fd, buffer.data(), buffer.size());
+        if (n <= 0)
+        {
+            break;
+        }
+        total += (guint64)n;
+    }
+}
+
+/* RTP version 2, PT 96, the rest does not matter to the write path */
+static void make_buffers(std::vector<GByteArray*>* _buffers, guint _count)
+{
+    std::vector<guint8> rtp(g_size, 0);
+    GstRTSPMessage      message = { };
+
+    rtp[0] = 0x80;
+    rtp[1] = 96;
+
+    gst_rtsp_message_init_data(&message, 0);
+    gst_rtsp_message_set_body(&message, rtp.data(), (guint)rtp.size());
+    for (guint i = 0; i < _count; i++)
+    {
+        _buffers->push_back(tcp_sender_serialize(&message));
+    }
+    gst_rtsp_message_unset(&message);
+}
+
+/* write all n buffers, waiting whenever the socket is full */
+static bool write_batch(GSocket* _socket, GByteArray** _buffers, guint _n, guint64* _writes)
+{
+    guint first  = 0;
+    gsize offset = 0;
+
+    while (first < _n)
+    {
+        gsize written = 0;
+
+        if (tcp_sender_write(_socket, _buffers + first, _n - first, offset, &written) != GST_RTSP_OK)
+        {
+            return false;
+        }
+        if (written == 0)
+        {
+            g_socket_condition_wait(_socket, G_IO_OUT, NULL, NULL);
+            continue;
+        }
+
+        (*_writes)++;
+        written += offset;
+        while (first < _n && written >= _buffers[first]->len)
+        {
+            written -= _buffers[first]->len;
+            first++;
+        }
+        offset = written;
+    }
+    return true;
+}
+
+static bool bench_batch(GSocket* _socket, int _reader_fd,
+                        std::vector<GByteArray*>& _buffers, guint _batch)
+{
+    guint64     bytes  = (guint64)g_packets * (g_size + BENCH_INTERLEAVED_HEAD);
+    guint64     writes = 0;
+    gint        sent   = 0;
+    std::thread reader(drain, _reader_fd, bytes);
+    gint64      start  = g_get_monotonic_time();
+
+    while (sent < g_packets)
+    {
+        guint n = (guint)MIN((gint)_batch, g_packets - sent);
+
+        if (!write_batch(_socket, _buffers.data(), n, &writes))
+        {
+            printf("[%s][batch %u write failed]\n", TAG, _batch);
+            shutdown(_reader_fd, SHUT_RDWR);
+            reader.join();
+            return false;
+        }
+        sent += n;
+    }
+    reader.join();
+
+    double seconds = (g_get_monotonic_time() - start) / (double)G_TIME_SPAN_SECOND;
+    printf("[%s][batch %3u: %9.0f packets/s %9.0f writes/s %7.1f MB/s]\n", TAG, _batch,
+        sent / seconds, writes / seconds, bytes / seconds / (1024 * 1024));
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    GOptionContext*             optctx;
+    GError*                     error  = NULL;
+    GSocket*                    socket = NULL;
+    std::vector<GByteArray*>    buffers;
+    int                         fds[2];
+    int                         ret    = 0;
+
+    optctx = g_option_context_new("- packets/s of batched interleaved RTP writes");
+    g_option_context_add_main_entries(optctx, entries, NULL);
+    g_option_context_add_group(optctx, gst_init_get_option_group());
+    if (!g_option_context_parse(optctx, &argc, &argv, &error)) {
+        g_printerr("Error parsing options: %s\n", error->message);
+        g_option_context_free(optctx);
+        g_clear_error(&error);
+        return -1;
+    }
+    g_option_context_free(optctx);
+
+    if (g_packets <= 0 || g_size < 12 || g_size > G_MAXUINT16)
+    {
+        g_printerr("--packets must be > 0 and --size within 12..65535\n");
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        perror("socketpair");
+        return -1;
+    }
+
+    socket = g_socket_new_from_fd(fds[0], &error);
+    if (!socket)
+    {
+        g_printerr("wrap socket failed: %s\n", error ? error->message : "");
+        g_clear_error(&error);
+        return -1;
+    }
+
+    make_buffers(&buffers, g_batches[G_N_ELEMENTS(g_batches) - 1]);
+    printf("[%s][%d packets of %d bytes per batch size]\n", TAG, g_packets, g_size);
+
+    for (guint batch : g_batches)
+    {
+        if (!bench_batch(socket, fds[1], buffers, batch))
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    for (GByteArray* buffer : buffers)
+    {
+        g_byte_array_unref(buffer);
+    }
+    g_object_unref(socket);
+    close(fds[1]);
+    return ret;
+}
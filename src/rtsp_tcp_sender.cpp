@@ -0,0 +1,539 @@
+#include "rtsp_tcp_sender.h"
+#include "h264_nal.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <glib-unix.h>
+
+#define TCP_SENDER_TIMEOUT_SEC  5           // a socket that takes nothing for this long is closed
+#define TCP_SENDER_TIMEOUT_USEC (TCP_SENDER_TIMEOUT_SEC * G_USEC_PER_SEC)
+
+#define RTP_NAL_STAP_A          24
+#define RTP_NAL_FU_A            28
+
+struct TcpSenderEntry
+{
+    GByteArray*     data;           // the message as it goes on the wire
+    bool            close;          // close the connection once it is written
+    bool            rtp;            // interleaved RTP data, may be dropped
+};
+
+struct TcpSenderClient
+{
+    GstRTSPClient*             client      = nullptr;  // referenced while scheduled
+    std::mutex                 lock;
+    std::deque<TcpSenderEntry> queue;
+    guint                      rtp_queued  = 0;        // RTP entries in queue
+    bool                       scheduled   = false;
+    bool                       waiting_idr = false;
+    bool                       closed      = false;
+
+    /* owned by whoever has the client scheduled, a worker or the poll thread */
+    std::deque<TcpSenderEntry> inflight;               // taken from queue, partly written
+    gsize                      offset      = 0;        // bytes of inflight.front() written
+    bool                       timed_out   = false;
+};
+
+static GThreadPool*          g_sender_pool = nullptr;
+static GMainContext*         g_poll_context = nullptr;  // waits for full sockets to drain
+static guint                 g_backlog     = 0;
+static guint                 g_batch_max   = 0;
+
+static std::atomic<guint64>  g_packets {0};
+static std::atomic<guint64>  g_writes  {0};
+static std::atomic<guint64>  g_dropped {0};
+static std::atomic<guint64>  g_blocked {0};
+static gint64                g_stats_time = 0;
+
+/* interleaved data on an even channel carries RTP, odd channels RTCP */
+static bool message_is_rtp(GstRTSPMessage* _message)
+{
+    guint8 channel = 0;
+
+    if (gst_rtsp_message_get_type(_message) != GST_RTSP_MESSAGE_DATA)
+    {
+        return false;
+    }
+    gst_rtsp_message_parse_data(_message, &channel);
+    return (channel & 1) == 0;
+}
+
+/* true if the H.264 RTP packet starts an IDR or the parameter sets before it */
+static bool rtp_payload_starts_idr(const guint8* _rtp, gsize _size)
+{
+    gsize  offset;
+    guint8 type;
+
+    if (_size < 12)
+    {
+        return false;
+    }
+
+    offset = 12 + 4 * (_rtp[0] & 0x0f);                 // CSRC list
+    if ((_rtp[0] & 0x10) && _size >= offset + 4)        // header extension
+    {
+        offset += 4 + 4 * ((_rtp[offset + 2] << 8) | _rtp[offset + 3]);
+    }
+    if (_size < offset + 2)
+    {
+        return false;
+    }
+
+    type = _rtp[offset] & 0x1f;
+    if (type == RTP_NAL_FU_A)
+    {
+        if (!(_rtp[offset + 1] & 0x80))                 // not the first fragment
+        {
+            return false;
+        }
+        type = _rtp[offset + 1] & 0x1f;
+    }
+    else if (type == RTP_NAL_STAP_A)
+    {
+        if (_size < offset + 4)
+        {
+            return false;
+        }
+        type = _rtp[offset + 3] & 0x1f;                 // first aggregated NAL
+    }
+
+    return type == H264_NAL_SLICE_IDR || type == H264_NAL_SPS || type == H264_NAL_PPS;
+}
+
+static bool message_starts_idr(GstRTSPMessage* _message)
+{
+    guint8* data = NULL;
+    guint   size = 0;
+
+    if (gst_rtsp_message_has_body_buffer(_message))
+    {
+        GstBuffer* buffer = NULL;
+        GstMapInfo map;
+        bool       idr = false;
+
+        gst_rtsp_message_peek_body_buffer(_message, &buffer);
+        if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ))
+        {
+            idr = rtp_payload_starts_idr(map.data, map.size);
+            gst_buffer_unmap(buffer, &map);
+        }
+        return idr;
+    }
+
+    gst_rtsp_message_get_body(_message, &data, &size);
+    return data && rtp_payload_starts_idr(data, size);
+}
+
+/* drop the queued RTP data of a client, responses and RTCP stay. lock held */
+static void tcp_sender_drop_rtp(TcpSenderClient* sc)
+{
+    std::deque<TcpSenderEntry> keep;
+
+    for (TcpSenderEntry& entry : sc->queue)
+    {
+        if (entry.rtp)
+        {
+            g_byte_array_unref(entry.data);
+            g_dropped++;
+        }
+        else
+        {
+            keep.push_back(entry);
+        }
+    }
+    sc->queue.swap(keep);
+    sc->rtp_queued = 0;
+}
+
+static void tcp_sender_free_entries(std::deque<TcpSenderEntry>* entries)
+{
+    for (TcpSenderEntry& entry : *entries)
+    {
+        g_byte_array_unref(entry.data);
+    }
+    entries->clear();
+}
+
+static void tcp_sender_client_free(gpointer _udata)
+{
+    TcpSenderClient* sc = (TcpSenderClient*)_udata;
+
+    tcp_sender_free_entries(&sc->queue);
+    tcp_sender_free_entries(&sc->inflight);
+    delete sc;
+}
+
+GByteArray* tcp_sender_serialize(GstRTSPMessage* message)
+{
+    GstRTSPMsgType type   = gst_rtsp_message_get_type(message);
+    GByteArray*    out;
+    GstBuffer*     buffer = NULL;
+    GstMapInfo     map;
+    guint8*        body   = NULL;
+    guint          size   = 0;
+
+    if (type != GST_RTSP_MESSAGE_DATA && type != GST_RTSP_MESSAGE_RESPONSE &&
+        type != GST_RTSP_MESSAGE_REQUEST)
+    {
+        return NULL;
+    }
+
+    if (gst_rtsp_message_has_body_buffer(message))
+    {
+        gst_rtsp_message_peek_body_buffer(message, &buffer);
+        if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+        {
+            return NULL;
+        }
+        body = map.data;
+        size = (guint)map.size;
+    }
+    else
+    {
+        gst_rtsp_message_get_body(message, &body, &size);
+    }
+
+    out = g_byte_array_sized_new(size + 4);
+    if (type == GST_RTSP_MESSAGE_DATA)
+    {
+        guint8 channel = 0;
+        guint8 head[4];
+
+        gst_rtsp_message_parse_data(message, &channel);
+        head[0] = '$';
+        head[1] = channel;
+        head[2] = (guint8)(size >> 8);
+        head[3] = (guint8)(size & 0xff);
+        g_byte_array_append(out, head, sizeof(head));
+    }
+    else
+    {
+        /* what the connection writes: start line, headers, length, body */
+        GString*       head = g_string_new(NULL);
+        GstRTSPVersion version;
+        gchar*         length = NULL;
+
+        if (type == GST_RTSP_MESSAGE_RESPONSE)
+        {
+            GstRTSPStatusCode code;
+            const gchar*      reason = NULL;
+
+            gst_rtsp_message_parse_response(message, &code, &reason, &version);
+            g_string_append_printf(head, "RTSP/%s %d %s\r\n",
+                gst_rtsp_version_as_text(version), (gint)code, reason ? reason : "");
+        }
+        else
+        {
+            GstRTSPMethod method;
+            const gchar*  uri = NULL;
+
+            gst_rtsp_message_parse_request(message, &method, &uri, &version);
+            g_string_append_printf(head, "%s %s RTSP/%s\r\n",
+                gst_rtsp_method_as_text(method), uri ? uri : "*", gst_rtsp_version_as_text(version));
+        }
+        gst_rtsp_message_append_headers(message, head);
+        if (size > 0 &&
+            gst_rtsp_message_get_header(message, GST_RTSP_HDR_CONTENT_LENGTH, &length, 0) != GST_RTSP_OK)
+        {
+            g_string_append_printf(head, "Content-Length: %u\r\n", size);
+        }
+        g_string_append(head, "\r\n");
+        g_byte_array_append(out, (const guint8*)head->str, (guint)head->len);
+        g_string_free(head, TRUE);
+    }
+
+    if (size > 0)
+    {
+        g_byte_array_append(out, body, size);
+    }
+    if (buffer)
+    {
+        gst_buffer_unmap(buffer, &map);
+    }
+    return out;
+}
+
+GstRTSPResult tcp_sender_write(GSocket* socket, GByteArray** buffers, guint n_buffers,
+                               gsize offset, gsize* written)
+{
+    std::vector<GOutputVector> vectors(n_buffers);
+    GError*                    error = NULL;
+    GPollableReturn            res;
+
+    for (guint i = 0; i < n_buffers; i++)
+    {
+        vectors[i].buffer = buffers[i]->data;
+        vectors[i].size   = buffers[i]->len;
+    }
+    vectors[0].buffer = buffers[0]->data + offset;
+    vectors[0].size  -= offset;
+
+    /* a zero timeout returns instead of waiting for a full socket */
+    *written = 0;
+    res = g_socket_send_message_with_timeout(socket, NULL, vectors.data(), (gint)n_buffers,
+                                             NULL, 0, G_SOCKET_MSG_NONE, 0, written, NULL, &error);
+    if (res == G_POLLABLE_RETURN_WOULD_BLOCK)
+    {
+        *written = 0;
+        return GST_RTSP_OK;
+    }
+    if (res != G_POLLABLE_RETURN_OK)
+    {
+        printf("[tcp_sender][write: %s]\n", error ? error->message : "failed");
+        g_clear_error(&error);
+        return GST_RTSP_ESYS;
+    }
+    return GST_RTSP_OK;
+}
+
+/* drop everything queued and close, after the last write or a failed one */
+static void tcp_sender_close(TcpSenderClient* sc)
+{
+    {
+        std::lock_guard<std::mutex> guard(sc->lock);
+        sc->closed     = true;
+        sc->scheduled  = false;
+        sc->rtp_queued = 0;
+        tcp_sender_free_entries(&sc->queue);
+    }
+    tcp_sender_free_entries(&sc->inflight);
+    sc->offset = 0;
+    gst_rtsp_client_close(sc->client);
+}
+
+/* poll thread: the socket takes data again (or the wait timed out), back to a worker */
+static gboolean tcp_sender_writable(gint _fd, GIOCondition _condition, gpointer _udata)
+{
+    TcpSenderClient* sc = (TcpSenderClient*)_udata;
+
+    sc->timed_out = _condition == 0;        // the ready time passed first
+    g_thread_pool_push(g_sender_pool, sc, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+/* park a client on a full socket, the worker moves on. it stays scheduled
+ * and keeps its client reference until a worker picks it up again */
+static void tcp_sender_wait_writable(TcpSenderClient* sc, GSocket* socket)
+{
+    GSource* source = g_unix_fd_source_new(g_socket_get_fd(socket),
+                                           (GIOCondition)(G_IO_OUT | G_IO_ERR | G_IO_HUP));
+
+    g_blocked++;
+    g_source_set_callback(source, (GSourceFunc)(tcp_sender_writable), sc, NULL);
+    g_source_set_ready_time(source, g_get_monotonic_time() + TCP_SENDER_TIMEOUT_USEC);
+    g_source_attach(source, g_poll_context);
+    g_source_unref(source);
+}
+
+static void tcp_sender_worker(gpointer _data, gpointer _udata)
+{
+    TcpSenderClient*          sc     = (TcpSenderClient*)_data;
+    GstRTSPClient*            client = sc->client;
+    GstRTSPConnection*        conn   = gst_rtsp_client_get_connection(client);
+    GSocket*                  socket = conn ? gst_rtsp_connection_get_write_socket(conn) : NULL;
+    std::vector<GByteArray*>  buffers;
+
+    if (sc->timed_out)
+    {
+        printf("[tcp_sender][client %p took nothing for %ds, close]\n", client, TCP_SENDER_TIMEOUT_SEC);
+        sc->timed_out = false;
+        tcp_sender_close(sc);
+        g_object_unref(client);
+        return;
+    }
+
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> guard(sc->lock);
+
+            if (sc->closed || !socket || (sc->inflight.empty() && sc->queue.empty()))
+            {
+                sc->scheduled = false;
+                break;
+            }
+
+            /* top up to one batch, nothing goes after a close */
+            while (!sc->queue.empty() && sc->inflight.size() < g_batch_max &&
+                   (sc->inflight.empty() || !sc->inflight.back().close))
+            {
+                sc->inflight.push_back(sc->queue.front());
+                sc->queue.pop_front();
+                if (sc->inflight.back().rtp)
+                {
+                    sc->rtp_queued--;
+                }
+            }
+        }
+
+        /* one vectored write for the whole batch, as much as the socket takes */
+        buffers.clear();
+        for (TcpSenderEntry& entry : sc->inflight)
+        {
+            buffers.push_back(entry.data);
+        }
+
+        gsize         written = 0;
+        GstRTSPResult res     = tcp_sender_write(socket, buffers.data(), (guint)buffers.size(),
+                                                 sc->offset, &written);
+        bool          close   = false;
+
+        if (res != GST_RTSP_OK)
+        {
+            printf("[tcp_sender][client %p write failed, res:%d, close]\n", client, res);
+            tcp_sender_close(sc);
+            break;
+        }
+        if (written == 0)
+        {
+            tcp_sender_wait_writable(sc, socket);
+            return;
+        }
+
+        g_writes++;
+        written += sc->offset;
+        while (!sc->inflight.empty() && written >= sc->inflight.front().data->len)
+        {
+            TcpSenderEntry& entry = sc->inflight.front();
+
+            written -= entry.data->len;
+            if (entry.rtp)
+            {
+                g_packets++;
+            }
+            close = entry.close;
+            g_byte_array_unref(entry.data);
+            sc->inflight.pop_front();
+        }
+        sc->offset = written;
+
+        if (close)
+        {
+            tcp_sender_close(sc);
+            break;
+        }
+    }
+
+    g_object_unref(client);
+}
+
+static gboolean tcp_sender_send_messages(GstRTSPClient*  _client,
+                                         GstRTSPSession* _session,
+                                         GstRTSPMessage* _messages,
+                                         guint           _n_messages,
+                                         gboolean        _close,
+                                         gpointer        _udata)
+{
+    TcpSenderClient* sc = (TcpSenderClient*)_udata;
+    bool schedule = false;
+
+    {
+        std::lock_guard<std::mutex> guard(sc->lock);
+
+        if (sc->closed)
+        {
+            return FALSE;
+        }
+
+        for (guint i = 0; i < _n_messages; i++)
+        {
+            GstRTSPMessage* message = &_messages[i];
+            GByteArray*     data    = NULL;
+            bool            rtp     = message_is_rtp(message);
+
+            if (rtp && !sc->waiting_idr && sc->rtp_queued >= g_backlog)
+            {
+                printf("[tcp_sender][client %p backlog full, drop to next IDR]\n", _client);
+                tcp_sender_drop_rtp(sc);
+                sc->waiting_idr = true;
+            }
+            if (rtp && sc->waiting_idr)
+            {
+                if (!message_starts_idr(message))
+                {
+                    g_dropped++;
+                    continue;
+                }
+                sc->waiting_idr = false;
+            }
+
+            data = tcp_sender_serialize(message);
+            if (!data)
+            {
+                continue;
+            }
+            sc->queue.push_back({ data, _close && i == _n_messages - 1, rtp });
+            if (rtp)
+            {
+                sc->rtp_queued++;
+            }
+        }
+
+        if (!sc->scheduled && !sc->queue.empty())
+        {
+            sc->scheduled = true;
+            schedule      = true;
+        }
+    }
+
+    if (schedule)
+    {
+        g_object_ref(_client);
+        g_thread_pool_push(g_sender_pool, sc, NULL);
+    }
+    return TRUE;
+}
+
+static gpointer tcp_sender_poll_thread(gpointer _udata)
+{
+    GMainLoop* loop = (GMainLoop*)_udata;
+
+    g_main_context_push_thread_default(g_poll_context);
+    g_main_loop_run(loop);
+    return NULL;
+}
+
+void tcp_sender_init(guint workers, guint backlog, guint batch_max)
+{
+    g_backlog      = backlog;
+    g_batch_max    = CLAMP(batch_max, 1u, (guint)IOV_MAX);
+    g_sender_pool  = g_thread_pool_new(tcp_sender_worker, NULL, (gint)workers, FALSE, NULL);
+    g_poll_context = g_main_context_new();
+    g_thread_unref(g_thread_new("tcp-sender-poll", tcp_sender_poll_thread,
+                                g_main_loop_new(g_poll_context, FALSE)));
+    g_stats_time   = g_get_monotonic_time();
+}
+
+void tcp_sender_attach(GstRTSPClient* client)
+{
+    TcpSenderClient* sc = new TcpSenderClient();
+    sc->client = client;
+
+    /* replaces the client's watch based sender, sc is freed with the client */
+    gst_rtsp_client_set_send_messages_func(client, tcp_sender_send_messages,
+                                           sc, tcp_sender_client_free);
+}
+
+void tcp_sender_print_stats()
+{
+    gint64  now     = g_get_monotonic_time();
+    double  seconds = (now - g_stats_time) / (double)G_TIME_SPAN_SECOND;
+    guint64 packets = g_packets.exchange(0);
+    guint64 writes  = g_writes.exchange(0);
+    guint64 dropped = g_dropped.exchange(0);
+    guint64 blocked = g_blocked.exchange(0);
+
+    g_stats_time = now;
+    if (seconds <= 0)
+    {
+        return;
+    }
+
+    printf("[tcp_sender][%.0f packets/s %.0f writes/s %.1f packets/write dropped:%llu blocked:%llu]\n",
+        packets / seconds, writes / seconds, writes ? (double)packets / writes : 0.0,
+        (unsigned long long)dropped, (unsigned long long)blocked);
+}
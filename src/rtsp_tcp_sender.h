@@ -0,0 +1,42 @@
+#ifndef RTSP_TCP_SENDER_H
+#define RTSP_TCP_SENDER_H
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+/**
+ * batched sender for RTP-over-TCP (interleaved) clients.
+ *
+ * once a client has a session, every message it sends (RTSP responses and
+ * interleaved RTP/RTCP) is queued per client in its wire form and written by
+ * a small pool of sender threads, up to batch_max messages per vectored write.
+ * writes never wait: what a full socket does not take stays queued and the
+ * client is handed to a poll thread until the socket drains, so neither the
+ * streaming thread of a shared pipeline nor a sender thread blocks on one
+ * slow socket. a socket that takes nothing for 5 s closes its client.
+ *
+ * when a client has backlog RTP messages queued, that RTP data is
+ * dropped and further RTP data is discarded until the next IDR (or the
+ * SPS/PPS in front of it), so the client resumes with a decodable picture.
+ * */
+
+void tcp_sender_init(guint workers, guint backlog, guint batch_max);
+
+/* take over sending for the client, call once its session exists */
+void tcp_sender_attach(GstRTSPClient* client);
+
+/* the message as written on the connection, an interleaved '$' frame or
+ * RTSP text. NULL for message types the sender does not write */
+GByteArray* tcp_sender_serialize(GstRTSPMessage* message);
+
+/* one vectored write of the buffers that never waits, what a sender thread
+ * does per batch. offset skips what an earlier write took of the first
+ * buffer, written is 0 when the socket is full */
+GstRTSPResult tcp_sender_write(GSocket* socket, GByteArray** buffers, guint n_buffers,
+                               gsize offset, gsize* written);
+
+/* packets/s, writes/s, drops and full-socket waits since the previous call */
+void tcp_sender_print_stats();
+
+#endif // RTSP_TCP_SENDER_H
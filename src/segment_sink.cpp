@@ -0,0 +1,269 @@
+#include "segment_sink.h"
+
+#include <cerrno>
+#include <cstring>
+#include <gst/base/gstbasesink.h>
+
+struct SegmentSink
+{
+    GstBaseSink    parent;
+    SegmentWriter* writer;
+    gchar*         location;
+};
+
+struct SegmentSinkClass
+{
+    GstBaseSinkClass parent_class;
+};
+
+enum
+{
+    PROP_0,
+    PROP_LOCATION,
+    PROP_DIRECT,
+    PROP_DROP_CACHE,
+    PROP_PREALLOCATE,
+};
+
+#define SEGMENT_SINK(obj) ((SegmentSink*)(obj))
+
+G_DEFINE_TYPE(SegmentSink, segment_sink, GST_TYPE_BASE_SINK);
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void segment_sink_set_property(GObject* object, guint prop_id,
+                                      const GValue* value, GParamSpec* pspec)
+{
+    SegmentSink* sink = SEGMENT_SINK(object);
+    SegmentWriterConfig& config = sink->writer->config;
+
+    switch (prop_id)
+    {
+    case PROP_LOCATION:
+        /* splitmuxsink sets it between two segments, with the file closed */
+        g_free(sink->location);
+        sink->location = g_value_dup_string(value);
+        break;
+    case PROP_DIRECT:
+        config.direct = g_value_get_boolean(value);
+        break;
+    case PROP_DROP_CACHE:
+        config.drop_cache = g_value_get_boolean(value);
+        break;
+    case PROP_PREALLOCATE:
+        config.preallocate = g_value_get_uint64(value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void segment_sink_get_property(GObject* object, guint prop_id,
+                                      GValue* value, GParamSpec* pspec)
+{
+    SegmentSink* sink = SEGMENT_SINK(object);
+    SegmentWriterConfig& config = sink->writer->config;
+
+    switch (prop_id)
+    {
+    case PROP_LOCATION:
+        g_value_set_string(value, sink->location);
+        break;
+    case PROP_DIRECT:
+        g_value_set_boolean(value, config.direct);
+        break;
+    case PROP_DROP_CACHE:
+        g_value_set_boolean(value, config.drop_cache);
+        break;
+    case PROP_PREALLOCATE:
+        g_value_set_uint64(value, config.preallocate);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void segment_sink_finalize(GObject* object)
+{
+    SegmentSink* sink = SEGMENT_SINK(object);
+
+    delete sink->writer;
+    g_free(sink->location);
+
+    G_OBJECT_CLASS(segment_sink_parent_class)->finalize(object);
+}
+
+static gboolean segment_sink_start(GstBaseSink* bsink)
+{
+    SegmentSink* sink = SEGMENT_SINK(bsink);
+
+    if (!sink->location)
+    {
+        GST_ELEMENT_ERROR(sink, RESOURCE, NOT_FOUND,
+            ("No file name specified for writing."), (NULL));
+        return FALSE;
+    }
+    if (!segment_writer_open(sink->writer, sink->location))
+    {
+        GST_ELEMENT_ERROR(sink, RESOURCE, OPEN_WRITE,
+            ("Could not open file \"%s\" for writing.", sink->location), GST_ERROR_SYSTEM);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean segment_sink_stop(GstBaseSink* bsink)
+{
+    SegmentSink* sink = SEGMENT_SINK(bsink);
+
+    if (!segment_writer_close(sink->writer))
+    {
+        GST_ELEMENT_ERROR(sink, RESOURCE, WRITE,
+            ("Error while writing to file \"%s\".", sink->location),
+            ("%s", g_strerror(sink->writer->error)));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static GstFlowReturn segment_sink_render(GstBaseSink* bsink, GstBuffer* buffer)
+{
+    SegmentSink* sink = SEGMENT_SINK(bsink);
+    GstMapInfo   info;
+    bool         written;
+
+    if (!gst_buffer_map(buffer, &info, GST_MAP_READ))
+    {
+        return GST_FLOW_ERROR;
+    }
+    written = segment_writer_write(sink->writer, info.data, info.size);
+    gst_buffer_unmap(buffer, &info);
+
+    /* a failed write shows up on the next buffer, the I/O thread is behind */
+    if (!written)
+    {
+        GST_ELEMENT_ERROR(sink, RESOURCE, WRITE,
+            ("Error while writing to file \"%s\".", sink->location),
+            ("%s", g_strerror(sink->writer->error)));
+        return GST_FLOW_ERROR;
+    }
+    return GST_FLOW_OK;
+}
+
+static gboolean segment_sink_event(GstBaseSink* bsink, GstEvent* event)
+{
+    SegmentSink* sink = SEGMENT_SINK(bsink);
+
+    /* the muxer seeks with a byte segment, qtmux to rewrite its headers */
+    if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+    {
+        const GstSegment* segment = NULL;
+
+        gst_event_parse_segment(event, &segment);
+        if (segment->format == GST_FORMAT_BYTES)
+        {
+            segment_writer_seek(sink->writer, segment->start);
+        }
+    }
+    return GST_BASE_SINK_CLASS(segment_sink_parent_class)->event(bsink, event);
+}
+
+static gboolean segment_sink_query(GstBaseSink* bsink, GstQuery* query)
+{
+    SegmentSink* sink = SEGMENT_SINK(bsink);
+    GstFormat    format;
+
+    switch (GST_QUERY_TYPE(query))
+    {
+    case GST_QUERY_SEEKING:
+        gst_query_parse_seeking(query, &format, NULL, NULL, NULL);
+        gst_query_set_seeking(query, format,
+            format == GST_FORMAT_BYTES || format == GST_FORMAT_DEFAULT, 0, -1);
+        return TRUE;
+    case GST_QUERY_POSITION:
+        gst_query_parse_position(query, &format, NULL);
+        if (format == GST_FORMAT_BYTES || format == GST_FORMAT_DEFAULT)
+        {
+            gst_query_set_position(query, GST_FORMAT_BYTES, (gint64)sink->writer->position);
+            return TRUE;
+        }
+        break;
+    default:
+        break;
+    }
+    return GST_BASE_SINK_CLASS(segment_sink_parent_class)->query(bsink, query);
+}
+
+static void segment_sink_class_init(SegmentSinkClass* klass)
+{
+    GObjectClass*     gobject_class  = G_OBJECT_CLASS(klass);
+    GstElementClass*  element_class  = GST_ELEMENT_CLASS(klass);
+    GstBaseSinkClass* basesink_class = GST_BASE_SINK_CLASS(klass);
+
+    gobject_class->set_property = segment_sink_set_property;
+    gobject_class->get_property = segment_sink_get_property;
+    gobject_class->finalize     = segment_sink_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_LOCATION,
+        g_param_spec_string("location", "File Location", "Location of the file to write",
+            NULL, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+    g_object_class_install_property(gobject_class, PROP_DIRECT,
+        g_param_spec_boolean("direct", "Direct I/O", "Write aligned chunks with O_DIRECT",
+            FALSE, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+    g_object_class_install_property(gobject_class, PROP_DROP_CACHE,
+        g_param_spec_boolean("drop-cache", "Drop Cache", "Drop buffered writes from the page cache",
+            FALSE, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+    g_object_class_install_property(gobject_class, PROP_PREALLOCATE,
+        g_param_spec_uint64("preallocate", "Preallocate", "Bytes allocated up front per segment (0 = off)",
+            0, G_MAXUINT64, 0, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    gst_element_class_set_static_metadata(element_class,
+        "Segment File Sink", "Sink/File",
+        "Write stream to a file from an I/O thread, optionally with O_DIRECT", "gst_record");
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+
+    basesink_class->start  = GST_DEBUG_FUNCPTR(segment_sink_start );
+    basesink_class->stop   = GST_DEBUG_FUNCPTR(segment_sink_stop  );
+    basesink_class->render = GST_DEBUG_FUNCPTR(segment_sink_render);
+    basesink_class->event  = GST_DEBUG_FUNCPTR(segment_sink_event );
+    basesink_class->query  = GST_DEBUG_FUNCPTR(segment_sink_query );
+}
+
+static void segment_sink_init(SegmentSink* sink)
+{
+    sink->writer   = new SegmentWriter(SegmentWriterConfig());
+    sink->location = NULL;
+
+    gst_base_sink_set_sync(GST_BASE_SINK(sink), FALSE);
+}
+
+GstElement* segment_sink_new(const char* name, const SegmentWriterConfig& config)
+{
+    static gsize registered = 0;
+    GstElement*  sink       = NULL;
+
+    if (g_once_init_enter(&registered))
+    {
+        gst_element_register(NULL, SEGMENT_SINK_NAME, GST_RANK_NONE, segment_sink_get_type());
+        g_once_init_leave(&registered, 1);
+    }
+
+    sink = gst_element_factory_make(SEGMENT_SINK_NAME, name);
+    if (sink)
+    {
+        g_object_set(G_OBJECT(sink),
+                     "direct"     , (gboolean)config.direct,
+                     "drop-cache" , (gboolean)config.drop_cache,
+                     "preallocate", (guint64)config.preallocate,
+                     NULL);
+    }
+    return sink;
+}
+
+void segment_sink_print_stats(const char* name, GstElement* sink)
+{
+    segment_writer_print_stats(name, SEGMENT_SINK(sink)->writer);
+}
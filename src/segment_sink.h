@@ -0,0 +1,27 @@
+#ifndef SEGMENT_SINK_H
+#define SEGMENT_SINK_H
+
+#include <gst/gst.h>
+
+#include "segment_writer.h"
+
+#define SEGMENT_SINK_NAME "segmentsink"
+
+/**
+ * file sink for splitmuxsink, the streaming thread only copies into the
+ * chunks of a SegmentWriter and its I/O thread does the writes.
+ *
+ * a drop-in for filesink: splitmuxsink sets location and cycles the state
+ * for every split file, each start / stop opens / closes one segment. byte
+ * segments from the muxer seek, and the sink answers seekable so qtmux can
+ * go back and rewrite its moov.
+ *
+ * properties : location, direct, drop-cache, preallocate
+ * */
+
+/* the element type is registered on first use */
+GstElement* segment_sink_new(const char* name, const SegmentWriterConfig& config);
+
+void segment_sink_print_stats(const char* name, GstElement* sink);
+
+#endif // SEGMENT_SINK_H
@@ -0,0 +1,362 @@
+#include "segment_writer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SEGMENT_WRITER_ROUND(n)  (((n) + SEGMENT_WRITER_ALIGN - 1) & ~(size_t)(SEGMENT_WRITER_ALIGN - 1))
+
+SegmentWriter::SegmentWriter(const SegmentWriterConfig& _config)
+    : config(_config)
+{
+    config.chunk_size = SEGMENT_WRITER_ROUND(MAX(config.chunk_size, (size_t)SEGMENT_WRITER_ALIGN));
+    config.chunks     = MAX(config.chunks, 2u);
+
+    storage.resize(config.chunks);
+    for (SegmentChunk& chunk : storage)
+    {
+        void* data = nullptr;
+        if (posix_memalign(&data, SEGMENT_WRITER_ALIGN, config.chunk_size) != 0)
+        {
+            continue;
+        }
+        chunk.data = (uint8_t*)data;
+        free_chunks.push_back(&chunk);
+    }
+}
+
+SegmentWriter::~SegmentWriter()
+{
+    segment_writer_close(this);
+    for (SegmentChunk& chunk : storage)
+    {
+        free(chunk.data);
+    }
+}
+
+static int segment_writer_pwrite(int fd, const uint8_t* data, size_t size, guint64 offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, data, size, (off_t)offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno;
+        }
+        data   += n;
+        size   -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* I/O thread, errno of the write or 0 */
+static int segment_writer_flush(SegmentWriter* writer, SegmentChunk* chunk)
+{
+    int error = 0;
+
+    if (writer->direct_fd >= 0 &&
+        chunk->offset % SEGMENT_WRITER_ALIGN == 0 && chunk->size % SEGMENT_WRITER_ALIGN == 0)
+    {
+        error = segment_writer_pwrite(writer->direct_fd, chunk->data, chunk->size, chunk->offset);
+        if (error == 0)
+        {
+            writer->direct_writes++;
+            writer->written += chunk->size;
+            return 0;
+        }
+        if (error != EINVAL)
+        {
+            return error;
+        }
+
+        /* the filesystem wants another alignment, the rest goes buffered */
+        printf("[segment_writer][%s O_DIRECT refused, writing buffered]\n", writer->location.c_str());
+        close(writer->direct_fd);
+        writer->direct_fd = -1;
+    }
+
+    error = segment_writer_pwrite(writer->fd, chunk->data, chunk->size, chunk->offset);
+    if (error != 0)
+    {
+        return error;
+    }
+    writer->written += chunk->size;
+    writer->buffered_writes++;
+
+    /* DONTNEED only drops clean pages, write the range back first */
+    if (writer->config.drop_cache)
+    {
+        sync_file_range(writer->fd, (off64_t)chunk->offset, (off64_t)chunk->size,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(writer->fd, (off_t)chunk->offset, (off_t)chunk->size, POSIX_FADV_DONTNEED);
+    }
+    return 0;
+}
+
+static void segment_writer_run(SegmentWriter* writer)
+{
+    std::unique_lock<std::mutex> guard(writer->lock);
+
+    for (;;)
+    {
+        writer->cond.wait(guard, [writer]() { return !writer->pending.empty() || writer->closing; });
+        if (writer->pending.empty())
+        {
+            break;
+        }
+
+        SegmentChunk* chunk = writer->pending.front();
+        writer->pending.pop_front();
+        guard.unlock();
+
+        /* after a failure the segment is lost anyway, the chunks only cycle */
+        int error = writer->error ? 0 : segment_writer_flush(writer, chunk);
+
+        guard.lock();
+        if (error != 0)
+        {
+            writer->error = error;
+        }
+        writer->end = MAX(writer->end, chunk->offset + chunk->size);
+        writer->free_chunks.push_back(chunk);
+        writer->cond.notify_all();
+    }
+}
+
+/* a chunk ends on an aligned offset, after an unaligned seek the next one is aligned again */
+static void segment_writer_start_chunk(SegmentWriter* writer, SegmentChunk* chunk)
+{
+    chunk->size   = 0;
+    chunk->offset = writer->position;
+    chunk->limit  = writer->config.chunk_size - writer->position % SEGMENT_WRITER_ALIGN;
+}
+
+static SegmentChunk* segment_writer_acquire(SegmentWriter* writer)
+{
+    std::unique_lock<std::mutex> guard(writer->lock);
+    SegmentChunk* chunk = nullptr;
+
+    if (writer->free_chunks.empty())
+    {
+        writer->stalls++;
+        writer->cond.wait(guard, [writer]() { return !writer->free_chunks.empty(); });
+    }
+    chunk = writer->free_chunks.back();
+    writer->free_chunks.pop_back();
+    guard.unlock();
+
+    segment_writer_start_chunk(writer, chunk);
+    return chunk;
+}
+
+static void segment_writer_queue(SegmentWriter* writer, SegmentChunk* chunk)
+{
+    {
+        std::lock_guard<std::mutex> guard(writer->lock);
+
+        if (chunk->size > 0)
+        {
+            writer->pending.push_back(chunk);
+        }
+        else
+        {
+            writer->free_chunks.push_back(chunk);
+        }
+    }
+    writer->cond.notify_all();
+}
+
+static void segment_writer_submit(SegmentWriter* writer)
+{
+    segment_writer_queue(writer, writer->current);
+    writer->current = nullptr;
+}
+
+/* the parked chunk is older than anything written since, it goes first */
+static void segment_writer_unpark(SegmentWriter* writer)
+{
+    if (writer->parked)
+    {
+        segment_writer_queue(writer, writer->parked);
+        writer->parked = nullptr;
+    }
+}
+
+bool segment_writer_open(SegmentWriter* writer, const char* location)
+{
+    segment_writer_close(writer);
+
+    if (writer->free_chunks.size() < 2)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    writer->fd = open(location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0)
+    {
+        return false;
+    }
+    writer->location = location;
+
+    /* tmpfs and a few others refuse O_DIRECT, they just get buffered writes */
+    if (writer->config.direct)
+    {
+        writer->direct_fd = open(location, O_WRONLY | O_DIRECT | O_CLOEXEC);
+    }
+
+    /* KEEP_SIZE : a cut file still ends at its last written byte */
+    if (writer->config.preallocate > 0 &&
+        fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)writer->config.preallocate) != 0)
+    {
+        printf("[segment_writer][%s preallocate failed: %s]\n", location, strerror(errno));
+    }
+
+    writer->position = 0;
+    writer->end      = 0;
+    writer->error    = 0;
+    writer->closing  = false;
+    writer->thread   = std::thread(segment_writer_run, writer);
+    return true;
+}
+
+bool segment_writer_write(SegmentWriter* writer, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    /* a rewrite reaching into the parked data has to land after it */
+    if (writer->parked && writer->position < writer->parked->offset + writer->parked->size &&
+        writer->position + size > writer->parked->offset)
+    {
+        segment_writer_unpark(writer);
+    }
+
+    while (size > 0 && !writer->error)
+    {
+        if (!writer->current)
+        {
+            writer->current = segment_writer_acquire(writer);
+        }
+
+        SegmentChunk* chunk = writer->current;
+        size_t n = MIN(size, chunk->limit - chunk->size);
+
+        memcpy(chunk->data + chunk->size, bytes, n);
+        chunk->size      += n;
+        writer->position += n;
+        bytes            += n;
+        size             -= n;
+
+        if (chunk->size == chunk->limit)
+        {
+            segment_writer_submit(writer);
+        }
+    }
+    return !writer->error;
+}
+
+bool segment_writer_seek(SegmentWriter* writer, guint64 offset)
+{
+    SegmentChunk* parked = writer->parked;
+
+    if (offset == writer->position)
+    {
+        return !writer->error;
+    }
+
+    /* back at the end of the data : the rewrite goes out on its own, the
+     * data chunk fills up to its aligned end as if nothing happened */
+    if (parked && offset == parked->offset + parked->size)
+    {
+        if (writer->current)
+        {
+            segment_writer_submit(writer);
+        }
+        writer->current  = parked;
+        writer->parked   = nullptr;
+        writer->position = offset;
+        writer->rewrites++;
+        return !writer->error;
+    }
+
+    /* a seek back behind the data, qtmux going to rewrite its moov, the
+     * chunk waits for the muxer to come back */
+    if (!parked && writer->current && writer->current->size > 0 && offset < writer->current->offset)
+    {
+        writer->parked   = writer->current;
+        writer->current  = nullptr;
+        writer->position = offset;
+        return !writer->error;
+    }
+
+    segment_writer_unpark(writer);
+    writer->position = offset;
+    if (writer->current && writer->current->size == 0)
+    {
+        segment_writer_start_chunk(writer, writer->current);
+    }
+    else if (writer->current)
+    {
+        segment_writer_submit(writer);
+    }
+    return !writer->error;
+}
+
+bool segment_writer_close(SegmentWriter* writer)
+{
+    if (writer->fd < 0)
+    {
+        return true;
+    }
+
+    segment_writer_unpark(writer);
+    if (writer->current)
+    {
+        segment_writer_submit(writer);
+    }
+    {
+        std::lock_guard<std::mutex> guard(writer->lock);
+        writer->closing = true;
+    }
+    writer->cond.notify_all();
+    writer->thread.join();
+
+    /* the preallocated blocks past the end stay allocated until truncated */
+    if (writer->config.preallocate > 0 && ftruncate(writer->fd, (off_t)writer->end) != 0)
+    {
+        printf("[segment_writer][%s truncate failed: %s]\n", writer->location.c_str(), strerror(errno));
+    }
+    if (writer->config.drop_cache)
+    {
+        posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    if (writer->direct_fd >= 0)
+    {
+        close(writer->direct_fd);
+        writer->direct_fd = -1;
+    }
+    close(writer->fd);
+    writer->fd = -1;
+
+    return !writer->error;
+}
+
+void segment_writer_print_stats(const char* name, SegmentWriter* writer)
+{
+    printf("[segment_writer][%s written:%lluKB direct:%llu buffered:%llu rewrites:%llu stalls:%llu%s]\n", name,
+        (unsigned long long)(writer->written / 1024),
+        (unsigned long long)writer->direct_writes,
+        (unsigned long long)writer->buffered_writes,
+        (unsigned long long)writer->rewrites,
+        (unsigned long long)writer->stalls,
+        writer->error ? " failed" : "");
+}
@@ -0,0 +1,106 @@
+#ifndef SEGMENT_WRITER_H
+#define SEGMENT_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glib.h>
+
+#define SEGMENT_WRITER_ALIGN        4096            // O_DIRECT offset / size / memory alignment
+#define SEGMENT_WRITER_CHUNK_SIZE   (1024*1024)
+#define SEGMENT_WRITER_CHUNKS       4
+
+struct SegmentWriterConfig
+{
+    bool    direct      = false;    // O_DIRECT for aligned chunks
+    bool    drop_cache  = false;    // posix_fadvise(DONTNEED) what went through the page cache
+    guint64 preallocate = 0;        // bytes fallocate'd when a segment is opened
+    size_t  chunk_size  = SEGMENT_WRITER_CHUNK_SIZE;
+    guint   chunks      = SEGMENT_WRITER_CHUNKS;
+};
+
+struct SegmentChunk
+{
+    uint8_t* data   = nullptr;      // SEGMENT_WRITER_ALIGN aligned, chunk_size bytes
+    size_t   size   = 0;            // bytes filled
+    size_t   limit  = 0;            // bytes this chunk takes, ends on an aligned offset
+    guint64  offset = 0;            // file offset of data[0]
+};
+
+/**
+ * one open segment file written from a dedicated I/O thread.
+ *
+ * the streaming thread copies into a fixed set of aligned chunks and hands
+ * full ones over, it only waits when every chunk is still being written,
+ * i.e. when the disk can not keep up. chunks starting on an aligned offset
+ * go out with O_DIRECT, anything else (the tail, the rewrites after a seek
+ * back) through a second, buffered descriptor. with drop_cache the buffered
+ * ranges are written back and dropped from the page cache right away.
+ *
+ * a seek back parks the chunk being filled instead of cutting it short.
+ * qtmux in robust mode rewrites its moov every second and then seeks back
+ * to where it left off, the parked chunk then goes on filling up to its
+ * aligned end. so the media data goes out O_DIRECT with qtmux as well as
+ * with fragmented mp4mux, only the small header rewrites, and the tail,
+ * are buffered. direct alone keeps those few pages in the page cache,
+ * direct with drop_cache leaves nothing there.
+ *
+ * the chunks are allocated once with the writer and reused for every segment.
+ * */
+struct SegmentWriter
+{
+    explicit SegmentWriter(const SegmentWriterConfig& config);
+    ~SegmentWriter();
+
+    SegmentWriterConfig        config;
+    std::string                location;
+    int                        fd        = -1;
+    int                        direct_fd = -1;
+
+    // streaming thread
+    SegmentChunk*              current   = nullptr;
+    SegmentChunk*              parked    = nullptr; // the data chunk during a rewrite
+    guint64                    position  = 0;       // where the next byte goes
+
+    // shared with the I/O thread
+    std::thread                thread;
+    std::mutex                 lock;
+    std::condition_variable    cond;
+    std::vector<SegmentChunk>  storage;
+    std::vector<SegmentChunk*> free_chunks;
+    std::deque<SegmentChunk*>  pending;
+    bool                       closing   = false;
+    std::atomic<int>           error     {0};       // errno of the first failed write
+    guint64                    end       = 0;       // file size so far
+
+    std::atomic<guint64>       written       {0};
+    std::atomic<guint64>       direct_writes {0};
+    std::atomic<guint64>       buffered_writes {0};
+    std::atomic<guint64>       rewrites      {0};   // returns to a parked chunk
+    std::atomic<guint64>       stalls        {0};   // the streaming thread waited for a chunk
+};
+
+/**
+ * @brief create / truncate the file and start its I/O thread
+ * @return false with errno set, the writer stays closed
+ * */
+bool segment_writer_open(SegmentWriter* writer, const char* location);
+
+/* streaming thread only, false once a write failed, see writer->error */
+bool segment_writer_write(SegmentWriter* writer, const void* data, size_t size);
+bool segment_writer_seek(SegmentWriter* writer, guint64 offset);
+
+/**
+ * @brief write out what is left, stop the I/O thread and close the file,
+ *        the preallocated space past the end is given back
+ * @return false if any write of the segment failed
+ * */
+bool segment_writer_close(SegmentWriter* writer);
+
+void segment_writer_print_stats(const char* name, SegmentWriter* writer);
+
+#endif // SEGMENT_WRITER_H
@@ -0,0 +1,77 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * bounded lock-free queue for exactly one producer and one consumer thread.
+ *
+ * the capacity is rounded up to a power of two. head and tail only grow, each
+ * side writes its own index and reads the other one, nothing else is shared.
+ * padding keeps the two a cache line apart without an over-aligned type,
+ * which plain new before C++17 does not honour.
+ * */
+template <typename T>
+struct SpscQueue
+{
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /* producer side, false if the queue is full */
+    bool push(const T& value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask)
+        {
+            return false;
+        }
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* consumer side, false if the queue is empty */
+    bool pop(T* value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        *value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* a snapshot, head is read first so it never passes tail */
+    size_t size() const
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+
+    bool   empty()    const { return size() == 0; }
+    bool   full()     const { return size() > mask; }
+    size_t capacity() const { return mask + 1; }
+
+    std::vector<T>       slots;
+    size_t               mask = 0;
+    std::atomic<size_t>  head {0};
+    char                 pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t>  tail {0};
+};
+
+#endif // SPSC_QUEUE_H